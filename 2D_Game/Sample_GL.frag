@@ -1,14 +1,42 @@
 #version 330 core
 
+// Feature #defines (TEXTURED, OVERDRAW) are inserted after the version
+// line for each variant, see shaderVariant() in practice.cpp
+
 // Interpolated values from the vertex shaders
+#ifdef TEXTURED
+in vec2 fragUV;
+
+// Packed sprite images, see atlaspack.cpp
+uniform sampler2D atlas;
+#else
 in vec3 fragColor;
+#endif
 
 // output data
+#ifdef OVERDRAW
+out vec4 color;	// one more draw on this pixel, summed by additive blending
+#else
 out vec3 color;
+#endif
 
 void main()
 {
+#ifdef TEXTURED
+    vec4 texel = texture(atlas, fragUV);
+
+    // Transparent texels leave colour and depth untouched
+    if (texel.a < 0.5)
+        discard;
+#endif
+
+#if defined(OVERDRAW)
+    color = vec4(1.0, 0.0, 0.0, 0.0);
+#elif defined(TEXTURED)
+    color = texel.rgb;
+#else
     // Output color = color specified in the vertex shader,
     // interpolated between all 3 surrounding vertices of the triangle
     color = fragColor;
+#endif
 }
@@ -1,22 +1,100 @@
 #version 330 core
 
+// Feature #defines (TEXTURED, OVERDRAW, VIEWS) are inserted after the version
+// line for each variant, see shaderVariant() in practice.cpp
+
 // input data : sent from main program
 layout (location = 0) in vec3 vertexPosition;
+#ifdef TEXTURED
+layout (location = 1) in vec2 vertexUV;
+// Motion kind, phase, and the corner in model space when the sprite moves
+layout (location = 2) in vec4 spriteMotion;
+
+// Linear part of the MVP of the moving sprites in the batch
+uniform vec4 spriteLinear;
+#else
 layout (location = 1) in vec3 vertexColor;
 
-uniform mat4 MVP;
+// 2D MVP as the rows of a 2x3 matrix: affine[0] = (a, c, tx, clip z),
+// affine[1] = (b, d, ty, unused). Every object is flat, so z is constant
+uniform vec4 affine[2];
+
+// Motion kind and phase of the object being drawn, kind 0 stays still
+uniform vec2 motion;
+#endif
+
+// Seconds, the same clock for every moving object in the frame
+uniform float time;
+
+#ifdef VIEWS
+#define MAX_VIEWS 2	// as in practice.cpp
+
+// Per split view: two rows taking the camera's clip space to the view's,
+// then the view's rectangle on the target (centre, half size)
+uniform vec4 views[3*MAX_VIEWS];
+
+// Move p, placed for the camera, into the view drawn by this instance and
+// clip it to that view's rectangle
+vec4 placeInView (vec4 p)
+{
+    int i = 3*gl_InstanceID;
+    vec3 q = vec3(p.xy, p.w);
+    vec2 v = vec2(dot(views[i].xyz, q), dot(views[i+1].xyz, q));
+    gl_ClipDistance[0] = p.w - v.x;
+    gl_ClipDistance[1] = p.w + v.x;
+    gl_ClipDistance[2] = p.w - v.y;
+    gl_ClipDistance[3] = p.w + v.y;
+    return vec4(views[i+2].xy*p.w + views[i+2].zw*v, p.zw);
+}
+#endif
 
 // output data : used by fragment shader
+#ifdef TEXTURED
+out vec2 fragUV;
+#else
 out vec3 fragColor;
+#endif
+
+// Model space point p moved by motion kind: 1 pulses and turns (spikes),
+// 2 bobs (key), 3 spins (exit). Keep in step with Sample_GL_tile.geom
+// and Sample_GL_hazard.vert
+vec2 animate (vec2 p, float kind, float phase)
+{
+    float t = time + phase;
+    if (kind == 1.0) {
+        float a = 0.8*t;
+        return (1.0 + 0.15*sin(4.0*t)) * mat2(cos(a), sin(a), -sin(a), cos(a)) * p;
+    }
+    if (kind == 2.0)
+        return p + vec2(0.0, 0.3*sin(3.0*t));
+    if (kind == 3.0) {
+        float a = -1.5*t;
+        return mat2(cos(a), sin(a), -sin(a), cos(a)) * p;
+    }
+    return p;
+}
 
 void main ()
 {
-    vec4 v = vec4(vertexPosition, 1); // Transform an homogeneous 4D vector
+#ifdef TEXTURED
+    // Sprites are batched from many objects, so each corner is
+    // transformed by its own MVP on the CPU. A moving sprite sends the
+    // origin of its object instead and the corner is placed here
+    fragUV = vertexUV;
+    vec2 corner = animate(spriteMotion.zw, spriteMotion.x, spriteMotion.y);
+    vec2 offset = mat2(spriteLinear.xy, spriteLinear.zw) * corner;
+    gl_Position = vec4(vertexPosition.xy + offset, vertexPosition.z, 1);
+#else
+    vec3 v = vec3(animate(vertexPosition.xy, motion.x, motion.y), 1); // Affine point in the XY plane
 
     // The color of each vertex will be interpolated
     // to produce the color of each fragment
     fragColor = vertexColor;
 
     // Output position of the vertex, in clip space : MVP * position
-    gl_Position = MVP * v;
+    gl_Position = vec4(dot(affine[0].xyz, v), dot(affine[1].xyz, v), affine[0].w, 1);
+#endif
+#ifdef VIEWS
+    gl_Position = placeInView(gl_Position);
+#endif
 }
@@ -0,0 +1,20 @@
+#version 330 core
+
+// Interpolated values from the vertex shaders
+in vec2 fragUV;
+
+uniform sampler2D source;
+uniform vec2 texelStep;	// one texel along the blur direction
+
+// output data
+out vec3 color;
+
+void main()
+{
+    // 9 tap gaussian in 5 fetches, bilinear filtering merges tap pairs
+    color = texture(source, fragUV).rgb * 0.2270270270;
+    color += texture(source, fragUV + texelStep * 1.3846153846).rgb * 0.3162162162;
+    color += texture(source, fragUV - texelStep * 1.3846153846).rgb * 0.3162162162;
+    color += texture(source, fragUV + texelStep * 3.2307692308).rgb * 0.0702702703;
+    color += texture(source, fragUV - texelStep * 3.2307692308).rgb * 0.0702702703;
+}
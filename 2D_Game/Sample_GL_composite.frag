@@ -0,0 +1,18 @@
+#version 330 core
+
+// Interpolated values from the vertex shaders
+in vec2 fragUV;
+
+uniform sampler2D glow;
+uniform float glowStrength;	// 0 when bloom is off
+uniform float vignette;	// darkening at the corners
+
+// output data, blended as glow + scene * alpha
+out vec4 color;
+
+void main()
+{
+    vec2 d = fragUV - 0.5;
+    float shade = clamp(1.0 - vignette * 2.0 * dot(d, d), 0.0, 1.0);
+    color = vec4(texture(glow, fragUV).rgb * glowStrength, shade);
+}
@@ -0,0 +1,10 @@
+#version 330 core
+
+// Transform feedback passes run with rasterization discarded; their
+// programs only need a fragment stage to link everywhere
+out vec4 color;
+
+void main()
+{
+    color = vec4(0.0);
+}
@@ -0,0 +1,60 @@
+#version 330 core
+
+// Feature #defines (OVERDRAW, VIEWS) are inserted after the version line,
+// as for the untextured variants of Sample_GL.vert
+
+// input data : the spike mesh, then one instance per spike
+layout (location = 0) in vec3 vertexPosition;
+layout (location = 1) in vec3 vertexColor;
+layout (location = 2) in vec3 hazard;	// centre x, y and motion phase
+
+// Same 2D view projection rows as Sample_GL.vert
+uniform vec4 affine[2];
+
+// Seconds, the same clock for every moving object in the frame
+uniform float time;
+
+#ifdef VIEWS
+#define MAX_VIEWS 2	// as in practice.cpp
+
+// Per split view: two rows taking the camera's clip space to the view's,
+// then the view's rectangle on the target (centre, half size)
+uniform vec4 views[3*MAX_VIEWS];
+
+// Instances run through every view of one spike before the next spike
+uniform int viewCount;
+
+// Same as in Sample_GL.vert, the view taken from the instance
+vec4 placeInView (vec4 p)
+{
+    int i = 3*(gl_InstanceID % viewCount);
+    vec3 q = vec3(p.xy, p.w);
+    vec2 v = vec2(dot(views[i].xyz, q), dot(views[i+1].xyz, q));
+    gl_ClipDistance[0] = p.w - v.x;
+    gl_ClipDistance[1] = p.w + v.x;
+    gl_ClipDistance[2] = p.w - v.y;
+    gl_ClipDistance[3] = p.w + v.y;
+    return vec4(views[i+2].xy*p.w + views[i+2].zw*v, p.zw);
+}
+#endif
+
+// output data : used by fragment shader
+out vec3 fragColor;
+
+// Motion kind 1 of Sample_GL.vert: pulse and turn
+vec2 pulse (vec2 p, float phase)
+{
+    float t = time + phase;
+    float a = 0.8*t;
+    return (1.0 + 0.15*sin(4.0*t)) * mat2(cos(a), sin(a), -sin(a), cos(a)) * p;
+}
+
+void main ()
+{
+    vec3 v = vec3(hazard.xy + pulse(vertexPosition.xy, hazard.z), 1);
+    fragColor = vertexColor;
+    gl_Position = vec4(dot(affine[0].xyz, v), dot(affine[1].xyz, v), affine[0].w, 1);
+#ifdef VIEWS
+    gl_Position = placeInView(gl_Position);
+#endif
+}
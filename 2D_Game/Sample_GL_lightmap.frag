@@ -0,0 +1,47 @@
+#version 330 core
+
+// Interpolated values from the vertex shaders
+in vec2 fragUV;
+
+#define MAX_LIGHTS 8
+#define SHADOW_STEPS 24
+
+uniform sampler2D tiles;	// red is 1 where a tile blocks light, one texel per world unit
+uniform vec4 view;	// camera box: x, y, width, height in world units
+uniform float hudLine;	// world y above which everything is fully lit
+uniform vec4 ambient;
+uniform int lightCount;
+uniform vec4 lights[MAX_LIGHTS];	// x, y, radius
+uniform vec4 lightColors[MAX_LIGHTS];
+
+// output data
+out vec3 color;
+
+void main()
+{
+    vec2 p = view.xy + fragUV * view.zw;
+    if (p.y > hudLine) {
+        color = vec3(1);
+        return;
+    }
+
+    vec2 grid = vec2(textureSize(tiles, 0));
+    color = ambient.rgb;
+    for (int i = 0; i < lightCount; i++) {
+        vec2 d = lights[i].xy - p;
+        float fall = 1.0 - length(d) / lights[i].z;
+        if (fall <= 0.0)
+            continue;
+
+        // Fixed number of samples towards the light, so the cost does not
+        // depend on how many tiles the level has. Samples in the texel's
+        // own tile are skipped so blocks are lit on the side facing the light
+        float lit = 1.0;
+        for (int s = 1; s <= SHADOW_STEPS; s++) {
+            vec2 q = p + d * (float(s) / float(SHADOW_STEPS + 1));
+            if (length(q - p) > 0.75)
+                lit *= 1.0 - texture(tiles, q / grid).r;
+        }
+        color += lightColors[i].rgb * fall * fall * lit;
+    }
+}
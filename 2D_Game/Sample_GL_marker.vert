@@ -0,0 +1,18 @@
+#version 330 core
+
+// input data : one instance per marker
+layout (location = 0) in vec4 marker;	// x, y in world units, point size in pixels, unused
+layout (location = 1) in vec4 markerColor;
+
+uniform vec4 mapRect;	// minimap corner and size in clip space
+
+// output data : used by fragment shader
+out vec4 fragColor;
+
+void main ()
+{
+    vec2 p = marker.xy / vec2(96.0, 54.0);
+    gl_Position = vec4(mapRect.xy + p * mapRect.zw, 0, 1);
+    gl_PointSize = marker.z;
+    fragColor = markerColor;
+}
@@ -0,0 +1,17 @@
+#version 330 core
+
+// Draw counts per pixel, the same size as the scene
+uniform sampler2D counts;
+
+// output data
+out vec4 color;
+
+// 0 draws is black, then blue, cyan, green, yellow, red, and white for 6 or more
+const vec3 ramp[7] = vec3[7](vec3(0.0, 0.0, 0.0), vec3(0.0, 0.0, 1.0), vec3(0.0, 1.0, 1.0),
+    vec3(0.0, 1.0, 0.0), vec3(1.0, 1.0, 0.0), vec3(1.0, 0.0, 0.0), vec3(1.0, 1.0, 1.0));
+
+void main()
+{
+    float n = texelFetch(counts, ivec2(gl_FragCoord.xy), 0).r;
+    color = vec4(ramp[int(clamp(n + 0.5, 0.0, 6.0))], 1.0);
+}
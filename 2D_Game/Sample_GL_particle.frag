@@ -0,0 +1,17 @@
+#version 330 core
+
+// Interpolated values from the vertex shaders
+in vec4 fragColor;
+
+// output data
+out vec4 color;
+
+void main()
+{
+    // Round points, soft towards the edge
+    vec2 d = gl_PointCoord - 0.5;
+    float r = dot(d, d) * 4.0;
+    if (r > 1.0)
+        discard;
+    color = vec4(fragColor.rgb, fragColor.a * (1.0 - r));
+}
@@ -0,0 +1,58 @@
+#version 330 core
+
+// input data : the buffer the update pass just wrote
+layout (location = 0) in vec4 posVel;	// position, velocity
+layout (location = 1) in vec4 life;	// age, lifetime, kind, unused
+
+uniform mat4 MVP;
+uniform float pointScale;	// pixels per world unit
+
+#ifdef VIEWS
+#define MAX_VIEWS 2	// as in practice.cpp
+
+// Per split view: two rows taking the camera's clip space to the view's,
+// then the view's rectangle on the target (centre, half size)
+uniform vec4 views[3*MAX_VIEWS];
+
+// Same as in Sample_GL.vert
+vec4 placeInView (vec4 p)
+{
+    int i = 3*gl_InstanceID;
+    vec3 q = vec3(p.xy, p.w);
+    vec2 v = vec2(dot(views[i].xyz, q), dot(views[i+1].xyz, q));
+    gl_ClipDistance[0] = p.w - v.x;
+    gl_ClipDistance[1] = p.w + v.x;
+    gl_ClipDistance[2] = p.w - v.y;
+    gl_ClipDistance[3] = p.w + v.y;
+    return vec4(views[i+2].xy*p.w + views[i+2].zw*v, p.zw);
+}
+#endif
+
+// output data : used by fragment shader
+out vec4 fragColor;
+
+void main ()
+{
+    if (life.x >= life.y) {
+        // Outside the clip volume, so nothing is rasterized
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        gl_PointSize = 1.0;
+        fragColor = vec4(0.0);
+#ifdef VIEWS
+        gl_Position = placeInView(gl_Position);
+#endif
+        return;
+    }
+
+    // Spike hits burn out from yellow to red, the exit burst from cyan to blue
+    float t = life.x / life.y;
+    vec3 hot = life.z < 0.5 ? vec3(1.0, 0.85, 0.3) : vec3(0.4, 1.0, 0.9);
+    vec3 cold = life.z < 0.5 ? vec3(0.8, 0.1, 0.05) : vec3(0.2, 0.3, 1.0);
+    fragColor = vec4(mix(hot, cold, t), 1.0 - t);
+
+    gl_Position = MVP * vec4(posVel.xy, 0, 1);
+#ifdef VIEWS
+    gl_Position = placeInView(gl_Position);
+#endif
+    gl_PointSize = max(1.0, pointScale * 0.35 * (1.0 - 0.5 * t));
+}
@@ -0,0 +1,56 @@
+#version 330 core
+
+#define EMITTERS 4
+
+// input data : one particle per vertex, read from the previous frame's buffer
+layout (location = 0) in vec4 posVel;	// position, velocity
+layout (location = 1) in vec4 life;	// age, lifetime, kind, unused
+
+// output data : captured by transform feedback into the other buffer
+out vec4 outPosVel;
+out vec4 outLife;
+
+uniform float dt;
+uniform int seed;	// changes every step
+uniform int particleCount;
+uniform int emitterCount;
+uniform vec4 emitter[EMITTERS];	// x, y, speed, kind
+uniform vec4 emitterSlots[EMITTERS];	// first slot, count
+
+// Integer hash to [0, 1]
+float random (uint n)
+{
+    n = (n << 13U) ^ n;
+    n = n * (n * n * 15731U + 789221U) + 1376312589U;
+    return float(n & 0x7fffffffU) / 2147483647.0;
+}
+
+void main ()
+{
+    // Slots an emitter fired into this step are respawned around it
+    for (int i = 0; i < emitterCount; i++) {
+        int offset = gl_VertexID - int(emitterSlots[i].x);
+        if (offset < 0)
+            offset += particleCount;
+        if (offset < int(emitterSlots[i].y)) {
+            uint n = uint(gl_VertexID) * 3U + uint(seed) * 7919U;
+            float angle = 6.2831853 * random(n);
+            float speed = emitter[i].z * (0.15 + 0.85 * random(n + 1U));
+            outPosVel = vec4(emitter[i].xy, speed * cos(angle), speed * sin(angle));
+            outLife = vec4(0.0, 0.6 + 1.2 * random(n + 2U), emitter[i].w, 0.0);
+            return;
+        }
+    }
+
+    // Dead particles just stay dead
+    if (life.x >= life.y) {
+        outPosVel = posVel;
+        outLife = life;
+        return;
+    }
+
+    // Drag, then gravity
+    vec2 velocity = posVel.zw * max(0.0, 1.0 - 2.5 * dt) - vec2(0.0, 18.0 * dt);
+    outPosVel = vec4(posVel.xy + velocity * dt, velocity);
+    outLife = vec4(life.x + dt, life.yzw);
+}
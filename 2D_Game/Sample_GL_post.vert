@@ -0,0 +1,12 @@
+#version 330 core
+
+// output data : used by fragment shader
+out vec2 fragUV;
+
+void main ()
+{
+    // One triangle that covers the whole target, no vertex buffer needed
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    fragUV = corner;
+    gl_Position = vec4(corner * 2.0 - 1.0, 0, 1);
+}
@@ -0,0 +1,15 @@
+#version 330 core
+
+// Interpolated values from the vertex shaders
+in vec2 fragUV;
+
+uniform sampler2D source;
+
+// output data
+out vec3 color;
+
+void main()
+{
+    // Plain bilinear fetch, used to stretch a low resolution target over the scene
+    color = texture(source, fragUV).rgb;
+}
@@ -0,0 +1,12 @@
+#version 330 core
+
+// One tile instance: centre x, y and kind (0 block, 1 spike)
+layout (location = 0) in vec3 tileInstance;
+
+out vec3 tile;
+
+void main ()
+{
+    // Culling and expansion to a quad happen in Sample_GL_tile.geom
+    tile = tileInstance;
+}
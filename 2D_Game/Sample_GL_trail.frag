@@ -0,0 +1,17 @@
+#version 330 core
+
+// Interpolated values from the vertex shaders
+in float fragAlpha;
+flat in int fragSkip;
+
+uniform vec4 trailColor;
+
+// output data
+out vec4 color;
+
+void main()
+{
+    if (fragSkip != 0)
+        discard;
+    color = vec4(trailColor.rgb, trailColor.a * fragAlpha);
+}
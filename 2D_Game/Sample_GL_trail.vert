@@ -0,0 +1,55 @@
+#version 330 core
+
+#define TRAIL_LENGTH 64
+
+// input data : two vertices per ring slot, centre and half-width offset,
+// then a copy of slot 0 after the last slot
+layout (location = 0) in vec4 trailPoint;
+
+uniform mat4 MVP;
+uniform int head;	// ring slot written last
+uniform int count;	// slots written since the shot started
+
+#ifdef VIEWS
+#define MAX_VIEWS 2	// as in practice.cpp
+
+// Per split view: two rows taking the camera's clip space to the view's,
+// then the view's rectangle on the target (centre, half size)
+uniform vec4 views[3*MAX_VIEWS];
+
+// Same as in Sample_GL.vert
+vec4 placeInView (vec4 p)
+{
+    int i = 3*gl_InstanceID;
+    vec3 q = vec3(p.xy, p.w);
+    vec2 v = vec2(dot(views[i].xyz, q), dot(views[i+1].xyz, q));
+    gl_ClipDistance[0] = p.w - v.x;
+    gl_ClipDistance[1] = p.w + v.x;
+    gl_ClipDistance[2] = p.w - v.y;
+    gl_ClipDistance[3] = p.w + v.y;
+    return vec4(views[i+2].xy*p.w + views[i+2].zw*v, p.zw);
+}
+#endif
+
+// output data : used by fragment shader
+out float fragAlpha;
+flat out int fragSkip;
+
+void main ()
+{
+    int slot = gl_VertexID / 2 % TRAIL_LENGTH;
+    int age = (head - slot + TRAIL_LENGTH) % TRAIL_LENGTH;
+    float fade = 1.0 - float(age) / float(TRAIL_LENGTH);
+
+    // The strip runs through the ring in slot order and back round to slot 0.
+    // Each segment takes its flag from its newer end (the provoking vertex),
+    // which drops the step from the newest slot back to the oldest and
+    // anything not yet written
+    fragSkip = age >= count - 1 ? 1 : 0;
+    fragAlpha = fade * fade;
+
+    gl_Position = MVP * vec4(trailPoint.xy + trailPoint.zw * fade, 0, 1);
+#ifdef VIEWS
+    gl_Position = placeInView(gl_Position);
+#endif
+}
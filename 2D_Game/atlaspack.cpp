@@ -0,0 +1,171 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+/* Packs the sprite images given on the command line into one atlas for
+   sample2D. Run by make; writes <out>.pam (RGBA) and <out>.txt, which
+   holds the atlas size and the pixel rectangle of every sprite.
+   Sources are PPM (P3 or P6); pure magenta (255,0,255) is transparent */
+
+using namespace std;
+
+struct Sprite {
+	string name;
+	int w, h;
+	vector<unsigned char> rgba;
+	int x, y;	// placement in the atlas, inside the padding
+};
+
+// Empty pixels around each sprite, filled by repeating its edge so
+// filtering never pulls in a neighbour
+#define PAD 1
+
+/* Next header token of a netpbm file, skipping # comments */
+int ppmToken (istream &in)
+{
+	int c = in.get();
+	while (c != EOF) {
+		if (c == '#') {
+			while (c != EOF && c != '\n')
+				c = in.get();
+		}
+		else if (!isspace(c))
+			break;
+		c = in.get();
+	}
+	int v = 0;
+	while (c != EOF && isdigit(c)) {
+		v = v*10 + (c - '0');
+		c = in.get();
+	}
+	return v;
+}
+
+int loadPPM (const char *path, Sprite &sp)
+{
+	ifstream in(path, ios::in | ios::binary);
+	char magic[2] = {0, 0};
+	in.read(magic, 2);
+	if (!in || magic[0] != 'P' || (magic[1] != '3' && magic[1] != '6')) {
+		fprintf(stderr, "Error: %s is not a PPM\n", path);
+		return 0;
+	}
+	sp.w = ppmToken(in);
+	sp.h = ppmToken(in);
+	int maxval = ppmToken(in);
+	if (sp.w <= 0 || sp.h <= 0 || maxval <= 0 || maxval > 255) {
+		fprintf(stderr, "Error: %s has an unsupported header\n", path);
+		return 0;
+	}
+	sp.rgba.resize(4*sp.w*sp.h);
+	for (int i=0; i < sp.w*sp.h; i++) {
+		int rgb[3];
+		for (int k=0; k < 3; k++)
+			rgb[k] = (magic[1] == '6' ? in.get() : ppmToken(in)) * 255 / maxval;
+		int clear = rgb[0] == 255 && rgb[1] == 0 && rgb[2] == 255;
+		for (int k=0; k < 3; k++)
+			sp.rgba[4*i+k] = clear ? 0 : rgb[k];
+		sp.rgba[4*i+3] = clear ? 0 : 255;
+	}
+	if (!in) {
+		fprintf(stderr, "Error: %s is truncated\n", path);
+		return 0;
+	}
+
+	string name = path;
+	size_t slash = name.find_last_of('/');
+	if (slash != string::npos)
+		name = name.substr(slash+1);
+	sp.name = name.substr(0, name.find('.'));
+	return 1;
+}
+
+bool tallerFirst (const Sprite &a, const Sprite &b)
+{
+	return a.h != b.h ? a.h > b.h : a.name < b.name;
+}
+
+/* Shelf packing: fill rows left to right, tallest sprites first */
+int pack (vector<Sprite> &sprites, int width, int height)
+{
+	int x = 0, y = 0, shelf = 0;
+	for (size_t i=0; i < sprites.size(); i++) {
+		int w = sprites[i].w + 2*PAD, h = sprites[i].h + 2*PAD;
+		if (w > width)
+			return 0;
+		if (x + w > width) {
+			x = 0;
+			y += shelf;
+			shelf = 0;
+		}
+		if (y + h > height)
+			return 0;
+		sprites[i].x = x + PAD;
+		sprites[i].y = y + PAD;
+		x += w;
+		shelf = max(shelf, h);
+	}
+	return 1;
+}
+
+int main (int argc, char** argv)
+{
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s out sprite.ppm...\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	vector<Sprite> sprites(argc-2);
+	for (int i=2; i < argc; i++) {
+		if (!loadPPM(argv[i], sprites[i-2]))
+			return EXIT_FAILURE;
+	}
+	sort(sprites.begin(), sprites.end(), tallerFirst);
+
+	// Smallest power of two square-ish atlas that fits everything
+	int width = 16, height = 16;
+	while (!pack(sprites, width, height)) {
+		if (width > height)
+			height *= 2;
+		else
+			width *= 2;
+		if (width > 4096) {
+			fprintf(stderr, "Error: sprites do not fit in a 4096 atlas\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	vector<unsigned char> atlas(4*width*height, 0);
+	for (size_t i=0; i < sprites.size(); i++) {
+		Sprite &sp = sprites[i];
+		for (int y=-PAD; y < sp.h+PAD; y++) {
+			for (int x=-PAD; x < sp.w+PAD; x++) {
+				int sx = min(max(x, 0), sp.w-1), sy = min(max(y, 0), sp.h-1);
+				memcpy(&atlas[4*((sp.y+y)*width + sp.x+x)], &sp.rgba[4*(sy*sp.w + sx)], 4);
+			}
+		}
+	}
+
+	string out = argv[1];
+	ofstream pam((out + ".pam").c_str(), ios::out | ios::binary);
+	pam << "P7\nWIDTH " << width << "\nHEIGHT " << height << "\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n";
+	pam.write((const char*)&atlas[0], atlas.size());
+
+	ofstream txt((out + ".txt").c_str());
+	txt << width << " " << height << "\n";
+	for (size_t i=0; i < sprites.size(); i++)
+		txt << sprites[i].name << " " << sprites[i].x << " " << sprites[i].y << " " << sprites[i].w << " " << sprites[i].h << "\n";
+
+	if (!pam || !txt) {
+		fprintf(stderr, "Error: could not write %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	printf("%s: %d sprites in %dx%d\n", argv[1], (int)sprites.size(), width, height);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,96 @@
+/* Binary GL command stream shared by the game's --capture recorder and the
+   replay tool.
+
+   File layout: the 8 byte magic, then u32 version, u32 framebuffer width
+   and height at capture time, then a sequence of commands. Each command is
+   a u8 opcode followed by its arguments in call order, little endian:
+   enums, names, ints and sizes as u32, floats as f32, buffer offsets as
+   u64. Pointer arguments are inlined as a u32 byte count and the bytes
+   (count 0 for a NULL pointer). Calls that create names (glGen*,
+   glCreateShader/Program) and glGetUniformLocation store the values the
+   driver returned so the replay can map them to its own.
+
+   Everything before the first CAP_FRAME is setup (shaders, meshes);
+   the replay runs it once and can loop over the frames after it. */
+#ifndef GLCAPTURE_H
+#define GLCAPTURE_H
+
+#define CAP_MAGIC "GLCAP\0\0\1"
+#define CAP_VERSION 4
+
+enum CapOp {
+	CAP_END = 0,
+	CAP_FRAME,
+
+	// state
+	CAP_CLEAR,
+	CAP_CLEAR_COLOR,
+	CAP_CLEAR_DEPTH,
+	CAP_ENABLE,
+	CAP_DISABLE,
+	CAP_DEPTH_FUNC,
+	CAP_BLEND_FUNC,
+	CAP_VIEWPORT,
+	CAP_POLYGON_MODE,
+	CAP_PIXEL_STOREI,
+
+	// shaders
+	CAP_CREATE_SHADER,
+	CAP_SHADER_SOURCE,
+	CAP_COMPILE_SHADER,
+	CAP_DELETE_SHADER,
+	CAP_CREATE_PROGRAM,
+	CAP_ATTACH_SHADER,
+	CAP_LINK_PROGRAM,
+	CAP_USE_PROGRAM,
+	CAP_GET_UNIFORM_LOCATION,
+	CAP_UNIFORM_MATRIX4FV,
+	CAP_UNIFORM1I,
+	CAP_UNIFORM1F,
+	CAP_UNIFORM2F,
+	CAP_UNIFORM4F,
+	CAP_UNIFORM4FV,
+
+	// buffers and vertex arrays
+	CAP_GEN_VERTEX_ARRAYS,
+	CAP_BIND_VERTEX_ARRAY,
+	CAP_GEN_BUFFERS,
+	CAP_BIND_BUFFER,
+	CAP_BUFFER_DATA,
+	CAP_BUFFER_SUB_DATA,
+	CAP_VERTEX_ATTRIB_POINTER,
+	CAP_ENABLE_VERTEX_ATTRIB_ARRAY,
+	CAP_DISABLE_VERTEX_ATTRIB_ARRAY,
+	CAP_VERTEX_ATTRIB_DIVISOR,
+	CAP_DRAW_ARRAYS,
+	CAP_DRAW_ARRAYS_INSTANCED,
+
+	// textures and framebuffers
+	CAP_GEN_TEXTURES,
+	CAP_BIND_TEXTURE,
+	CAP_ACTIVE_TEXTURE,
+	CAP_TEX_PARAMETERI,
+	CAP_TEX_IMAGE_2D,
+	CAP_TEX_SUB_IMAGE_2D,
+	CAP_GEN_FRAMEBUFFERS,
+	CAP_BIND_FRAMEBUFFER,
+	CAP_FRAMEBUFFER_TEXTURE_2D,
+	CAP_GEN_RENDERBUFFERS,
+	CAP_BIND_RENDERBUFFER,
+	CAP_RENDERBUFFER_STORAGE,
+	CAP_FRAMEBUFFER_RENDERBUFFER,
+	CAP_BLIT_FRAMEBUFFER,
+
+	// transform feedback
+	CAP_TRANSFORM_FEEDBACK_VARYINGS,
+	CAP_BIND_BUFFER_BASE,
+	CAP_BEGIN_TRANSFORM_FEEDBACK,
+	CAP_END_TRANSFORM_FEEDBACK,
+	CAP_GEN_TRANSFORM_FEEDBACKS,
+	CAP_BIND_TRANSFORM_FEEDBACK,
+	CAP_DRAW_TRANSFORM_FEEDBACK,
+
+	CAP_OP_COUNT
+};
+
+#endif
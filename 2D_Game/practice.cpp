@@ -2,6 +2,12 @@
 #include <cmath>
 #include <fstream>
 #include <vector>
+#include <map>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -11,8 +17,13 @@
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <string.h>
+#include <stdlib.h>
 #include <math.h>
 #include <sstream>
+#include "glcapture.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 
 
@@ -27,16 +38,134 @@ int pass,rmos=0,test=0,wid, hgt,level = 1,inc = 0,prick =0,n;
 double flag = 0,keyboard_movement = 0,mouse_movement = 0,power_movement = 0,k_pos_x,k_pos_y,e_pos_x,e_pos_y,s_w=96,s_h=54,w=96,h=54;
 float vel;
 struct VAO {
-	GLuint VertexArrayID;
-	GLuint VertexBuffer;
-	GLuint ColorBuffer;
+	// First vertex of the object in the GL backend's mesh buffer, -1 elsewhere
+	int MeshFirst;
 
 	GLenum PrimitiveMode;
 	GLenum FillMode;
 	int NumVertices;
+
+	// CPU copies, only filled in for backends that rasterize themselves
+	vector<GLfloat> Vertices;
+	vector<GLfloat> Colors;
+
+	// Label for debug output, may be NULL
+	const char *Name;
+
+	// Circle fans also carry their analytic shape
+	int IsCircle;
+	float CircleX, CircleY, CircleRadius;
+
+	// Atlas sprite drawn over SpriteBox (x0, y0, x1, y1) instead of the mesh, -1 for none
+	int Sprite;
+	float SpriteBox[4];
+
+	// Drawn again into the bloom source when post-processing is on
+	int Glow;
+
+	// Motion kind and phase animated in Sample_GL.vert, kind 0 stays still
+	float Motion[2];
 };
 typedef struct VAO VAO;
 
+/**************************
+ * 2D affine transforms   *
+ **************************/
+
+/* Everything in the game is flat, so a model-view-projection is a 2x2
+   linear part plus a translation: x' = m[0]*x + m[2]*y + t[0] and
+   y' = m[1]*x + m[3]*y + t[1]. t[2] carries the clip space depth, which is
+   the same for every vertex because all objects sit at z = 0. Composing
+   two costs 12 multiplies (three SSE multiplies) instead of a mat4's 64,
+   and the shader takes it as two vec4s */
+struct Affine2 {
+	alignas(16) float m[4];
+	alignas(16) float t[4];
+};
+
+Affine2 affineTranslate (float x, float y)
+{
+	Affine2 a = {{1, 0, 0, 1}, {x, y, 0, 0}};
+	return a;
+}
+
+/* Rotate by angle radians about the origin, then move to (x, y) */
+Affine2 affineTranslateRotate (float x, float y, float angle)
+{
+	float c = cos(angle), s = sin(angle);
+	Affine2 a = {{c, s, -s, c}, {x, y, 0, 0}};
+	return a;
+}
+
+/* a applied after b */
+Affine2 operator* (const Affine2 &a, const Affine2 &b)
+{
+	Affine2 r;
+#ifdef __SSE2__
+	__m128 am = _mm_load_ps(a.m), bm = _mm_load_ps(b.m), bt = _mm_load_ps(b.t);
+	__m128 zero = _mm_setzero_ps();
+	// columns of a, repeated and zero padded
+	__m128 col0 = _mm_movelh_ps(am, am), col1 = _mm_movehl_ps(am, am);
+	__m128 col0z = _mm_movelh_ps(am, zero), col1z = _mm_movehl_ps(zero, am);
+	_mm_store_ps(r.m, _mm_add_ps(_mm_mul_ps(col0, _mm_shuffle_ps(bm, bm, _MM_SHUFFLE(2,2,0,0))),
+			_mm_mul_ps(col1, _mm_shuffle_ps(bm, bm, _MM_SHUFFLE(3,3,1,1)))));
+	_mm_store_ps(r.t, _mm_add_ps(_mm_load_ps(a.t), _mm_add_ps(_mm_mul_ps(col0z, _mm_shuffle_ps(bt, bt, _MM_SHUFFLE(0,0,0,0))),
+			_mm_mul_ps(col1z, _mm_shuffle_ps(bt, bt, _MM_SHUFFLE(1,1,1,1))))));
+#else
+	r.m[0] = a.m[0]*b.m[0] + a.m[2]*b.m[1];
+	r.m[1] = a.m[1]*b.m[0] + a.m[3]*b.m[1];
+	r.m[2] = a.m[0]*b.m[2] + a.m[2]*b.m[3];
+	r.m[3] = a.m[1]*b.m[2] + a.m[3]*b.m[3];
+	r.t[0] = a.m[0]*b.t[0] + a.m[2]*b.t[1] + a.t[0];
+	r.t[1] = a.m[1]*b.t[0] + a.m[3]*b.t[1] + a.t[1];
+	r.t[2] = a.t[2];
+	r.t[3] = 0;
+#endif
+	return r;
+}
+
+bool operator== (const Affine2 &a, const Affine2 &b)
+{
+	return !memcmp(a.m, b.m, sizeof(a.m)) && !memcmp(a.t, b.t, sizeof(a.t));
+}
+
+/* The 2D part of a view-projection without perspective (ortho * lookAt) */
+Affine2 affineFromMat4 (const glm::mat4 &mvp)
+{
+	Affine2 a = {{mvp[0][0], mvp[0][1], mvp[1][0], mvp[1][1]}, {mvp[3][0], mvp[3][1], mvp[3][2], 0}};
+	return a;
+}
+
+void affineApply (const Affine2 &a, float x, float y, float &ox, float &oy)
+{
+	ox = a.m[0]*x + a.m[2]*y + a.t[0];
+	oy = a.m[1]*x + a.m[3]*y + a.t[1];
+}
+
+/* Every object upload and draw goes through one of these.
+   The GL backend is the normal path, others are selected with --renderer */
+struct RenderBackend {
+	const char *name;
+	void (*init)(GLFWwindow *window);
+	void (*upload)(VAO *vao, const GLfloat *vertex_buffer_data, const GLfloat *color_buffer_data);
+	void (*beginFrame)(GLFWwindow *window);
+	void (*clear)();
+	void (*setMVP)(const Affine2 &mvp);
+	void (*draw)(VAO *vao);
+	void (*endFrame)(GLFWwindow *window);
+};
+extern RenderBackend gl_backend, soft_backend, null_backend;
+RenderBackend *backend = &gl_backend;
+int gl_available = 0;	// a GL context was created and loaded
+int dump_requested = 0;	// F12, write the next finished software frame to disk
+int damage_pending = 1;	// input arrived since the last drawn frame
+const char *gl_debug_object = NULL;	// name of the object being drawn, for debug output
+int gl_debug_labels = 0;	// label GL objects, set when --gl-debug is active
+int overdraw_enabled = 0;	// --overdraw, count draws per pixel instead of shading
+int animation_enabled = 1;	// --no-animation, spikes, key and exit move on the GL backend
+float anim_time = 0;	// seconds on the clock of every moving object, set once per frame
+const char *golden_dir = NULL;	// --golden DIR, compare frames against stored images
+
 vector<VAO*>arr_obs;
 vector<glm::vec3>obst;
 
@@ -47,74 +176,88 @@ struct GLMatrices {
 	glm::mat4 projection;
 	glm::mat4 model;
 	glm::mat4 view;
-	GLuint MatrixID;
+	GLint AffineID;	// vec4 affine[2] in Sample_GL.vert
+	GLint MotionID;	// vec2 motion, kind and phase of the object
+	float Motion[2];	// last values sent to MotionID
 } Matrices;
 
 
 GLuint programID;
 
-/* Function to load Shaders - Use it as it is */
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
-
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open())
-	{
-		std::string Line = "";
-		while(getline(VertexShaderStream, Line))
-			VertexShaderCode += "\n" + Line;
-		VertexShaderStream.close();
-	}
+/* Put a variant's feature #defines right after the #version line */
+void insertDefines (std::string &code, const char *defines)
+{
+	if (!defines || !*defines)
+		return;
+	// The code starts with a newline, so the second one ends #version
+	size_t end = code.find('\n', 1);
+	if (end == std::string::npos)
+		code += "\n" + std::string(defines);
+	else
+		code.insert(end+1, defines);
+}
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
+/* Read, compile and log one shader stage */
+GLuint compileShaderFile (GLenum type, const char *path, const char *defines)
+{
+	GLuint ShaderID = glCreateShader(type);
+	if (gl_debug_labels)
+		glObjectLabel(GL_SHADER, ShaderID, -1, path);
+
+	// Read the Shader code from the file
+	std::string ShaderCode;
+	std::ifstream ShaderStream(path, std::ios::in);
+	if(ShaderStream.is_open()){
 		std::string Line = "";
-		while(getline(FragmentShaderStream, Line))
-			FragmentShaderCode += "\n" + Line;
-		FragmentShaderStream.close();
+		while(getline(ShaderStream, Line))
+			ShaderCode += "\n" + Line;
+		ShaderStream.close();
 	}
+	insertDefines(ShaderCode, defines);
 
 	GLint Result = GL_FALSE;
 	int InfoLogLength;
 
-	// Compile Vertex Shader
-	printf("Compiling shader : %s\n", vertex_file_path);
-	char const * VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
-	glCompileShader(VertexShaderID);
-
-	// Check Vertex Shader
-	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	std::vector<char> VertexShaderErrorMessage(InfoLogLength);
-	glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-	fprintf(stdout, "%s\n", &VertexShaderErrorMessage[0]);
-
-	// Compile Fragment Shader
-	printf("Compiling shader : %s\n", fragment_file_path);
-	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
-	glCompileShader(FragmentShaderID);
-
-	// Check Fragment Shader
-	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	std::vector<char> FragmentShaderErrorMessage(InfoLogLength);
-	glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-	fprintf(stdout, "%s\n", &FragmentShaderErrorMessage[0]);
+	// Compile Shader
+	printf("Compiling shader : %s\n", path);
+	if (defines && *defines)
+		printf("%s", defines);
+	char const * SourcePointer = ShaderCode.c_str();
+	glShaderSource(ShaderID, 1, &SourcePointer , NULL);
+	glCompileShader(ShaderID);
+
+	// Check Shader
+	glGetShaderiv(ShaderID, GL_COMPILE_STATUS, &Result);
+	glGetShaderiv(ShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	std::vector<char> ShaderErrorMessage( max(InfoLogLength, int(1)) );
+	glGetShaderInfoLog(ShaderID, InfoLogLength, NULL, &ShaderErrorMessage[0]);
+	fprintf(stdout, "%s\n", &ShaderErrorMessage[0]);
+	return ShaderID;
+}
+
+/* Function to load Shaders - Use it as it is. A geometry stage is optional */
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path, const char *defines = NULL, int feedback_count = 0, const char **feedback_varyings = NULL, const char *geometry_file_path = NULL) {
+
+	// Create and compile the shaders
+	GLuint VertexShaderID = compileShaderFile(GL_VERTEX_SHADER, vertex_file_path, defines);
+	GLuint GeometryShaderID = geometry_file_path ? compileShaderFile(GL_GEOMETRY_SHADER, geometry_file_path, defines) : 0;
+	GLuint FragmentShaderID = compileShaderFile(GL_FRAGMENT_SHADER, fragment_file_path, defines);
+
+	GLint Result = GL_FALSE;
+	int InfoLogLength;
 
 	// Link the program
 	fprintf(stdout, "Linking program\n");
 	GLuint ProgramID = glCreateProgram();
+	if (gl_debug_labels)
+		glObjectLabel(GL_PROGRAM, ProgramID, -1, vertex_file_path);
 	glAttachShader(ProgramID, VertexShaderID);
+	if (GeometryShaderID)
+		glAttachShader(ProgramID, GeometryShaderID);
 	glAttachShader(ProgramID, FragmentShaderID);
+	// Vertex outputs captured by transform feedback are named before linking
+	if (feedback_count > 0)
+		glTransformFeedbackVaryings(ProgramID, feedback_count, feedback_varyings, GL_INTERLEAVED_ATTRIBS);
 	glLinkProgram(ProgramID);
 
 	// Check the program
@@ -125,11 +268,196 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	fprintf(stdout, "%s\n", &ProgramErrorMessage[0]);
 
 	glDeleteShader(VertexShaderID);
+	if (GeometryShaderID)
+		glDeleteShader(GeometryShaderID);
 	glDeleteShader(FragmentShaderID);
 
 	return ProgramID;
 }
 
+/**************************
+ * Split view             *
+ **************************/
+
+/* With --split-view the world is shown through two views side by side,
+   the camera box on the left and the exit on the right. draw() runs once:
+   every world draw is instanced once per view, and the VIEWS vertex
+   shaders move the position they computed for the camera into the view of
+   gl_InstanceID, clipped to its half of the target by gl_ClipDistance.
+   The second view costs fill rate and vertices, not draw calls */
+
+#define MAX_VIEWS 2
+#define VIEW_FLOATS 12	// views[] rows of the view's transform, then its rectangle
+#define VIEW_GAP 0.004f	// clip space between the views, left at the clear colour
+
+int split_view = 0;	// --split-view
+int view_count = 1;	// instances of each world draw
+GLfloat view_data[MAX_VIEWS*VIEW_FLOATS];	// placed by splitViewUpdate
+GLfloat view_sent[MAX_VIEWS*VIEW_FLOATS];	// what the programs below hold
+vector<GLuint> view_programs;
+vector<GLint> view_ids;
+
+/* Keep program's views[] up to date, if it has one */
+void viewRegister (GLuint program)
+{
+	GLint id = glGetUniformLocation(program, "views");
+	if (id < 0)
+		return;
+	view_programs.push_back(program);
+	view_ids.push_back(id);
+	glUseProgram(program);
+	glUniform4fv(id, 3*MAX_VIEWS, view_sent);
+	glUseProgram(programID);
+}
+
+/* View v shows the world box (x0, x1, y0, y1) in rect (x0, x1, y0, y1 in
+   clip space) of the target, given positions projected with camera box cam */
+void viewPlace (GLfloat *v, const float cam[4], const float box[4], const float rect[4])
+{
+	float bw = box[1] - box[0], bh = box[3] - box[2];
+	GLfloat packed[VIEW_FLOATS] = {
+		(cam[1] - cam[0])/bw, 0, (cam[0] + cam[1] - box[0] - box[1])/bw, 0,
+		0, (cam[3] - cam[2])/bh, (cam[2] + cam[3] - box[2] - box[3])/bh, 0,
+		(rect[0] + rect[1])/2, (rect[2] + rect[3])/2, (rect[1] - rect[0])/2, (rect[3] - rect[2])/2
+	};
+	memcpy(v, packed, sizeof(packed));
+}
+
+/* The middle half of camera box cam on the left and as much of the level
+   around the exit at (ex, ey) on the right, both at the camera's scale */
+void splitViewUpdate (const float cam[4], float ex, float ey)
+{
+	if (!split_view)
+		return;
+	float w = (cam[1] - cam[0])/2, h = cam[3] - cam[2], cx = (cam[0] + cam[1])/2;
+	float bx = min(max(ex - w/2, 0.0f), 96 - w), by = min(max(ey - h/2, 0.0f), 54 - h);
+	float left[4] = {cx - w/2, cx + w/2, cam[2], cam[3]}, right[4] = {bx, bx + w, by, by + h};
+	float left_rect[4] = {-1, -VIEW_GAP, -1, 1}, right_rect[4] = {VIEW_GAP, 1, -1, 1};
+	viewPlace(view_data, cam, left, left_rect);
+	viewPlace(view_data + VIEW_FLOATS, cam, right, right_rect);
+}
+
+/* Draw through the views of the frame, or with whole through a single
+   view covering the target. Programs are only updated when that changes */
+void viewsUse (int whole)
+{
+	if (!split_view)
+		return;
+	GLfloat data[MAX_VIEWS*VIEW_FLOATS];
+	memcpy(data, view_data, sizeof(data));
+	if (whole) {
+		GLfloat identity[VIEW_FLOATS] = {1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 1};
+		memcpy(data, identity, sizeof(identity));
+	}
+	view_count = whole ? 1 : MAX_VIEWS;
+	if (!memcmp(data, view_sent, sizeof(data)))
+		return;
+	memcpy(view_sent, data, sizeof(data));
+	for (size_t i=0; i < view_programs.size(); i++) {
+		glUseProgram(view_programs[i]);
+		glUniform4fv(view_ids[i], 3*MAX_VIEWS, view_sent);
+	}
+	glUseProgram(programID);
+}
+
+/* Clip distances only around the world draws; the full screen passes
+   leave them unwritten */
+void viewsClip (int on)
+{
+	if (!split_view)
+		return;
+	for (int i=0; i < 4; i++) {
+		if (on)
+			glEnable(GL_CLIP_DISTANCE0 + i);
+		else
+			glDisable(GL_CLIP_DISTANCE0 + i);
+	}
+}
+
+/* glDrawArrays once per view */
+void viewDrawArrays (GLenum mode, GLint first, GLsizei count)
+{
+	if (view_count > 1)
+		glDrawArraysInstanced(mode, first, count, view_count);
+	else
+		glDrawArrays(mode, first, count);
+}
+
+/**************************
+ * Shader variants        *
+ **************************/
+
+/* Sample_GL.vert/.frag are built in several variants, picked by a bitmask
+   of the features below. Each set bit becomes a #define after the
+   #version line. A variant is compiled the first time it is asked for and
+   kept for the run, so choosing one while drawing is an array lookup */
+enum {
+	SHADER_TEXTURED = 1,	// sample the sprite atlas, vertices already in clip space
+	SHADER_OVERDRAW = 2,	// output 1 per fragment for the overdraw heatmap
+	SHADER_VIEWS = 4,	// one instance per split view, see placeInView()
+	SHADER_FEATURES = 3
+};
+#define SHADER_VARIANTS (1 << SHADER_FEATURES)
+const char *shader_feature[SHADER_FEATURES] = {"TEXTURED", "OVERDRAW", "VIEWS"};
+
+struct ShaderVariant {
+	GLuint program;
+	GLint affine;	// vec4 affine[2], -1 in textured variants
+	GLint motion;	// vec2 motion, -1 in textured variants
+	GLint time;	// float time
+};
+ShaderVariant shader_variants[SHADER_VARIANTS];
+int shader_base = 0;	// features added to every variant, set once at init
+
+/* The #define lines for the features in mask */
+string shaderDefines (int mask)
+{
+	string defines;
+	for (int i=0; i < SHADER_FEATURES; i++) {
+		if (mask & (1 << i))
+			defines += string("#define ") + shader_feature[i] + "\n";
+	}
+	return defines;
+}
+
+void shaderBuild (int mask)
+{
+	ShaderVariant &v = shader_variants[mask];
+	v.program = LoadShaders("Sample_GL.vert", "Sample_GL.frag", shaderDefines(mask).c_str());
+	v.affine = glGetUniformLocation(v.program, "affine");
+	v.motion = glGetUniformLocation(v.program, "motion");
+	v.time = glGetUniformLocation(v.program, "time");
+	viewRegister(v.program);
+	// Sampler units never change, so they are set once here
+	GLint atlas = glGetUniformLocation(v.program, "atlas");
+	if (atlas >= 0) {
+		glUseProgram(v.program);
+		glUniform1i(atlas, 1);
+	}
+}
+
+/* The variant with the features in mask, compiled on first use. Variants
+   known at load time are asked for then, so play never waits on the
+   compiler */
+const ShaderVariant &shaderVariant (int mask)
+{
+	mask |= shader_base;
+	if (!shader_variants[mask].program)
+		shaderBuild(mask);
+	return shader_variants[mask];
+}
+
+/* Start the clock of every compiled variant at anim_time */
+void shaderSetTime ()
+{
+	for (int i=0; i < SHADER_VARIANTS; i++) {
+		if (!shader_variants[i].program)
+			continue;
+		glUseProgram(shader_variants[i].program);
+		glUniform1f(shader_variants[i].time, anim_time);
+	}
+}
+
 static void error_callback(int error, const char* description)
 {
 	fprintf(stderr, "Error: %s\n", description);
@@ -143,46 +471,151 @@ void quit(GLFWwindow *window)
 }
 
 
-/* Generate VAO, VBOs and return VAO handle */
+/**************************
+ * Mesh buffer            *
+ **************************/
+
+/* On the GL backend every mesh lives in one vertex buffer behind one VAO,
+   position and colour interleaved, each object a run of vertices drawn
+   from its first one. Runs are handed out first fit from a free list that
+   merges neighbours on release. When nothing fits the buffer doubles and
+   is refilled from the CPU copy, keeping its name and the VAO's attribute
+   setup, so the number of GL objects never changes */
+
+#define MESH_FLOATS 6	// x, y, z, r, g, b
+#define MESH_INITIAL 16384	// vertices
+
+GLuint mesh_vao = 0, mesh_vbo = 0;
+int mesh_capacity = 0;
+vector<GLfloat> mesh_shadow;	// what the buffer holds
+map<int, int> mesh_free;	// first vertex of each free run, and its length
+GLuint gl_vao = 0;	// vertex array last bound
+
+/* Every VAO is bound through here so the mesh draws skip rebinding theirs */
+void bindVertexArray (GLuint vao)
+{
+	if (vao == gl_vao)
+		return;
+	gl_vao = vao;
+	glBindVertexArray(vao);
+}
+
+/* Put count vertices from first back on the free list */
+void meshRelease (int first, int count)
+{
+	map<int, int>::iterator next = mesh_free.lower_bound(first);
+	if (next != mesh_free.end() && first + count == next->first) {
+		count += next->second;
+		next = mesh_free.erase(next);
+	}
+	if (next != mesh_free.begin()) {
+		map<int, int>::iterator prev = next;
+		--prev;
+		if (prev->first + prev->second == first) {
+			prev->second += count;
+			return;
+		}
+	}
+	mesh_free[first] = count;
+}
+
+/* Make room for capacity vertices, the first call creates the buffer */
+void meshGrow (int capacity)
+{
+	if (!mesh_vbo) {
+		glGenVertexArrays(1, &mesh_vao);
+		glGenBuffers(1, &mesh_vbo);
+	}
+	mesh_shadow.resize(capacity*MESH_FLOATS, 0);
+	bindVertexArray(mesh_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh_vbo);
+	glBufferData(GL_ARRAY_BUFFER, mesh_shadow.size()*sizeof(GLfloat), &mesh_shadow[0], GL_STATIC_DRAW);
+	if (!mesh_capacity) {
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, MESH_FLOATS*sizeof(GLfloat), (void*)0);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, MESH_FLOATS*sizeof(GLfloat), (void*)(3*sizeof(GLfloat)));
+		if (gl_debug_labels) {
+			glObjectLabel(GL_VERTEX_ARRAY, mesh_vao, -1, "meshes");
+			glObjectLabel(GL_BUFFER, mesh_vbo, -1, "meshes");
+		}
+	}
+	meshRelease(mesh_capacity, capacity - mesh_capacity);
+	mesh_capacity = capacity;
+}
+
+/* First vertex of a free run of count vertices */
+int meshAlloc (int count)
+{
+	for (;;) {
+		for (map<int, int>::iterator it = mesh_free.begin(); it != mesh_free.end(); ++it) {
+			if (it->second < count)
+				continue;
+			int first = it->first, left = it->second - count;
+			mesh_free.erase(it);
+			if (left)
+				mesh_free[first + count] = left;
+			return first;
+		}
+		meshGrow(max(2*mesh_capacity, MESH_INITIAL));
+	}
+}
+
+/* Copy an object's vertices into the mesh buffer on the GL backend */
+void glUpload3DObject (struct VAO* vao, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data)
+{
+	int numVertices = vao->NumVertices;
+	vao->MeshFirst = meshAlloc(numVertices);
+	GLfloat *run = &mesh_shadow[vao->MeshFirst*MESH_FLOATS];
+	for (int i=0; i < numVertices; i++) {
+		memcpy(run + i*MESH_FLOATS, vertex_buffer_data + 3*i, 3*sizeof(GLfloat));
+		memcpy(run + i*MESH_FLOATS + 3, color_buffer_data + 3*i, 3*sizeof(GLfloat));
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, mesh_vbo);
+	glBufferSubData(GL_ARRAY_BUFFER, vao->MeshFirst*MESH_FLOATS*sizeof(GLfloat), numVertices*MESH_FLOATS*sizeof(GLfloat), run);
+}
+
+/* Generate an object and hand its vertices to the active backend, return VAO handle */
 struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
 {
 	struct VAO* vao = new struct VAO;
 	vao->PrimitiveMode = primitive_mode;
 	vao->NumVertices = numVertices;
 	vao->FillMode = fill_mode;
+	vao->MeshFirst = -1;
+	vao->Name = NULL;
+	vao->IsCircle = 0;
+	vao->Sprite = -1;
+	vao->Glow = 0;
+	vao->Motion[0] = vao->Motion[1] = 0;
 
-	// Create Vertex Array Object
-	// Should be done after CreateWindow and before any other GL calls
-	glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
-	glGenBuffers (1, &(vao->VertexBuffer)); // VBO - vertices
-	glGenBuffers (1, &(vao->ColorBuffer));  // VBO - colors
-
-	glBindVertexArray (vao->VertexArrayID); // Bind the VAO 
-	glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices 
-	glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
-	glVertexAttribPointer(
-			0,                  // attribute 0. Vertices
-			3,                  // size (x,y,z)
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-			);
-
-	glBindBuffer (GL_ARRAY_BUFFER, vao->ColorBuffer); // Bind the VBO colors 
-	glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), color_buffer_data, GL_STATIC_DRAW);  // Copy the vertex colors
-	glVertexAttribPointer(
-			1,                  // attribute 1. Color
-			3,                  // size (r,g,b)
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-			);
+	backend->upload(vao, vertex_buffer_data, color_buffer_data);
 
 	return vao;
 }
 
+/* Give back an object from create3DObject */
+void free3DObject (struct VAO* vao)
+{
+	if (vao->MeshFirst >= 0)
+		meshRelease(vao->MeshFirst, vao->NumVertices);
+	delete vao;
+}
+
+// Motion kinds of Sample_GL.vert, around the object's origin
+#define MOTION_PULSE_SPIN 1
+#define MOTION_BOB 2
+#define MOTION_SPIN 3
+
+/* Let the vertex shader move vao from now on; phase offsets its clock */
+void animate (VAO* vao, int kind, float phase)
+{
+	if (!animation_enabled)
+		return;
+	vao->Motion[0] = kind;
+	vao->Motion[1] = phase;
+}
+
 /* Generate VAO, VBOs and return VAO handle - Common Color for all vertices */
 struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL)
 {
@@ -196,29 +629,154 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
 	return create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
 }
 
+/* Record the analytic shape of a circle fan built around (x, y) */
+VAO* markCircle (VAO* vao, float x, float y, float radius)
+{
+	vao->IsCircle = 1;
+	vao->CircleX = x;
+	vao->CircleY = y;
+	vao->CircleRadius = radius;
+	return vao;
+}
+
+void debugMeshName (const VAO* vao);
+
+/* Give an object a name for the debug log. Meshes share one buffer, so
+   GL debuggers can only tell them apart by the range a draw covers; that
+   range goes in the log with the name */
+void nameObject (VAO* vao, const char *name)
+{
+	vao->Name = name;
+	debugMeshName(vao);
+}
+
 /* Render the VBOs handled by VAO */
-void draw3DObject (struct VAO* vao)
+void glDraw3DObject (struct VAO* vao)
 {
+	gl_debug_object = vao->Name;
+
 	// Change the Fill Mode for this object
 	glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
 
-	// Bind the VAO to use
-	glBindVertexArray (vao->VertexArrayID);
-
-	// Enable Vertex Attribute 0 - 3d Vertices
-	glEnableVertexAttribArray(0);
-	// Bind the VBO to use
-	glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
+	// Moving objects are placed by the vertex shader; only send changes
+	if (vao->Motion[0] != Matrices.Motion[0] || vao->Motion[1] != Matrices.Motion[1]) {
+		Matrices.Motion[0] = vao->Motion[0];
+		Matrices.Motion[1] = vao->Motion[1];
+		glUniform2f(Matrices.MotionID, vao->Motion[0], vao->Motion[1]);
+	}
 
-	// Enable Vertex Attribute 1 - Color
-	glEnableVertexAttribArray(1);
-	// Bind the VBO to use
-	glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
+	// Every mesh shares one VAO, so this is a no-op between mesh draws
+	bindVertexArray(mesh_vao);
 
 	// Draw the geometry !
-	glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+	viewDrawArrays(vao->PrimitiveMode, vao->MeshFirst, vao->NumVertices);
+}
+
+/* Render an object with the active backend using the last MVP given to it */
+void spritePush (struct VAO* vao);
+void postGlow (struct VAO* vao);
+
+void draw3DObject (struct VAO* vao)
+{
+	if (vao->Glow)
+		postGlow(vao);
+	if (vao->Sprite >= 0) {
+		spritePush(vao);
+		return;
+	}
+	backend->draw(vao);
+}
+
+/**************************
+ * Debug drawing          *
+ **************************/
+
+/* Lines, boxes, circles and arrows in world units for looking at collisions
+   and physics. Only built with -DDEBUG_DRAW (make sample2D-debug), where F3
+   toggles them. Everything queued during a frame goes into one dynamic
+   vertex buffer and is drawn with a single GL_LINES call by DEBUG_FLUSH.
+   In normal builds the DEBUG_* macros expand to nothing, arguments and all */
+#ifdef DEBUG_DRAW
+
+int debug_draw_visible = 1;
+vector<GLfloat> debug_vertices;	// x, y, z, r, g, b per line end
+GLuint debug_vao = 0, debug_vbo = 0;
+
+void debugDrawLine (float x0, float y0, float x1, float y1, float r, float g, float b)
+{
+	if (!debug_draw_visible)
+		return;
+	GLfloat line[12] = {x0, y0, 0, r, g, b, x1, y1, 0, r, g, b};
+	debug_vertices.insert(debug_vertices.end(), line, line+12);
+}
+
+void debugDrawBox (float x0, float y0, float x1, float y1, float r, float g, float b)
+{
+	debugDrawLine(x0, y0, x1, y0, r, g, b);
+	debugDrawLine(x1, y0, x1, y1, r, g, b);
+	debugDrawLine(x1, y1, x0, y1, r, g, b);
+	debugDrawLine(x0, y1, x0, y0, r, g, b);
+}
+
+void debugDrawCircle (float x, float y, float radius, float r, float g, float b)
+{
+	const int sides = 24;
+	for (int i=0; i < sides; i++) {
+		float a0 = 2*M_PI*i/sides, a1 = 2*M_PI*(i+1)/sides;
+		debugDrawLine(x + radius*cos(a0), y + radius*sin(a0), x + radius*cos(a1), y + radius*sin(a1), r, g, b);
+	}
+}
+
+/* From (x, y) along (dx, dy), with a head at the far end */
+void debugDrawArrow (float x, float y, float dx, float dy, float r, float g, float b)
+{
+	float len = sqrt(dx*dx + dy*dy);
+	if (len < 1e-4)
+		return;
+	float head = max(0.3f, 0.25f*len), ux = dx/len*head, uy = dy/len*head;
+	float c = cos(0.45), s = sin(0.45);
+	debugDrawLine(x, y, x+dx, y+dy, r, g, b);
+	debugDrawLine(x+dx, y+dy, x+dx - (c*ux - s*uy), y+dy - (s*ux + c*uy), r, g, b);
+	debugDrawLine(x+dx, y+dy, x+dx - (c*ux + s*uy), y+dy - (-s*ux + c*uy), r, g, b);
+}
+
+/* Draw everything queued this frame with VP and start over */
+void debugDrawFlush (const Affine2 &VP)
+{
+	if (backend == &gl_backend && !debug_vertices.empty()) {
+		if (!debug_vao) {
+			glGenVertexArrays(1, &debug_vao);
+			glGenBuffers(1, &debug_vbo);
+			bindVertexArray(debug_vao);
+			glBindBuffer(GL_ARRAY_BUFFER, debug_vbo);
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6*sizeof(GLfloat), (void*)0);
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6*sizeof(GLfloat), (void*)(3*sizeof(GLfloat)));
+		}
+		gl_debug_object = "debug_draw";
+		bindVertexArray(debug_vao);
+		glBindBuffer(GL_ARRAY_BUFFER, debug_vbo);
+		glBufferData(GL_ARRAY_BUFFER, debug_vertices.size()*sizeof(GLfloat), &debug_vertices[0], GL_STREAM_DRAW);
+		backend->setMVP(VP);
+		viewDrawArrays(GL_LINES, 0, debug_vertices.size()/6);
+	}
+	debug_vertices.clear();
 }
 
+#define DEBUG_LINE(...) debugDrawLine(__VA_ARGS__)
+#define DEBUG_BOX(...) debugDrawBox(__VA_ARGS__)
+#define DEBUG_CIRCLE(...) debugDrawCircle(__VA_ARGS__)
+#define DEBUG_ARROW(...) debugDrawArrow(__VA_ARGS__)
+#define DEBUG_FLUSH(VP) debugDrawFlush(VP)
+#else
+#define DEBUG_LINE(...)
+#define DEBUG_BOX(...)
+#define DEBUG_CIRCLE(...)
+#define DEBUG_ARROW(...)
+#define DEBUG_FLUSH(VP)
+#endif
+
 /**************************
  * Customizable functions *
  **************************/
@@ -237,6 +795,7 @@ int status[3];
 void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
 {
 	// Function is called first on GLFW_PRESS.
+	damage_pending = 1;
 
 	if (action == GLFW_RELEASE) {
 		switch (key) {
@@ -288,6 +847,14 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
 			case GLFW_KEY_ESCAPE:
 				quit(window);
 				break;
+			case GLFW_KEY_F12:
+				dump_requested = 1;
+				break;
+#ifdef DEBUG_DRAW
+			case GLFW_KEY_F3:
+				debug_draw_visible = !debug_draw_visible;
+				break;
+#endif
 			case GLFW_KEY_R:
 				inc = 1 ;
 				break;
@@ -346,6 +913,7 @@ void keyboardChar (GLFWwindow* window, unsigned int key)
 /* Executed when a mouse button is pressed/released */
 void mouseButton (GLFWwindow* window, int button, int action, int mods)
 {
+	damage_pending = 1;
 	switch (button) {
 		case GLFW_MOUSE_BUTTON_LEFT:
 			if (action == GLFW_PRESS){
@@ -382,6 +950,11 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
 	w-= yoffset;
 }
+/* Window was exposed or resized, its contents need drawing again */
+void windowRefresh (GLFWwindow* window)
+{
+	damage_pending = 1;
+}
 void reshapeWindow (GLFWwindow* window, int width, int height)
 {
 	int fbwidth=width, fbheight=height;
@@ -392,7 +965,8 @@ void reshapeWindow (GLFWwindow* window, int width, int height)
 	GLfloat fov = 90.0f;
 
 	// sets the viewport of openGL renderer
-	glViewport (0, 0, (GLsizei) fbwidth, (GLsizei) fbheight);
+	if (gl_available)
+		glViewport (0, 0, (GLsizei) fbwidth, (GLsizei) fbheight);
 
 
 	// set the projection matrix as perspective
@@ -589,6 +1163,7 @@ VAO* createrectb()
 
 	// create3DObject creates and returns a handle to a VAO that can be used later
 	rectb = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+	return rectb;
 }
 VAO* createrecs()
 {
@@ -621,6 +1196,7 @@ VAO* createrecs()
 
 	// create3DObject creates and returns a handle to a VAO that can be used later
 	recs = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+	return recs;
 }
 
 
@@ -655,6 +1231,7 @@ VAO* createrecp()
 
 	// create3DObject creates and returns a handle to a VAO that can be used later
 	recp = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+	return recp;
 }
 
 void createrecball()
@@ -692,7 +1269,7 @@ void createrecball()
 
 
 
-void createball(int numberOfSides,int x,int y,int z,float radius){
+VAO* createball(int numberOfSides,int x,int y,int z,float radius){
 	int numberOfVertices = numberOfSides + 2;
 
 	GLfloat twicePi = 2.0f * M_PI;
@@ -727,11 +1304,10 @@ void createball(int numberOfSides,int x,int y,int z,float radius){
 
 	}
 
-	ball = create3DObject(GL_TRIANGLE_FAN, numberOfVertices, vertex_buffer_data, color_buffer_data, GL_FILL);
+	return markCircle(create3DObject(GL_TRIANGLE_FAN, numberOfVertices, vertex_buffer_data, color_buffer_data, GL_FILL), x, y, radius);
 
 }
-void createkey(){
-	int numberOfSides = 10000;
+VAO* createkey(int numberOfSides){
 	int numberOfVertices = numberOfSides + 2;
 
 	GLfloat twicePi = 2.0f * M_PI;
@@ -766,11 +1342,10 @@ void createkey(){
 
 	}
 
-	key = create3DObject(GL_TRIANGLE_FAN, numberOfVertices, vertex_buffer_data, color_buffer_data, GL_FILL);
+	return markCircle(create3DObject(GL_TRIANGLE_FAN, numberOfVertices, vertex_buffer_data, color_buffer_data, GL_FILL), 0, 0, 1);
 
 }
-void createexit(){
-	int numberOfSides = 10000;
+VAO* createexit(int numberOfSides){
 	int numberOfVertices = numberOfSides + 2;
 
 	GLfloat twicePi = 2.0f * M_PI;
@@ -805,12 +1380,11 @@ void createexit(){
 
 	}
 
-	ex = create3DObject(GL_TRIANGLE_FAN, numberOfVertices, vertex_buffer_data, color_buffer_data, GL_FILL);
+	return markCircle(create3DObject(GL_TRIANGLE_FAN, numberOfVertices, vertex_buffer_data, color_buffer_data, GL_FILL), 0, 0, 1.7);
 
 }
 
-void createsmall(){
-	int numberOfSides = 10000;
+VAO* createsmall(int numberOfSides){
 	int numberOfVertices = numberOfSides + 2;
 
 	GLfloat twicePi = 2.0f * M_PI;
@@ -845,7 +1419,7 @@ void createsmall(){
 
 	}
 
-	small = create3DObject(GL_TRIANGLE_FAN, numberOfVertices, vertex_buffer_data, color_buffer_data, GL_FILL);
+	return markCircle(create3DObject(GL_TRIANGLE_FAN, numberOfVertices, vertex_buffer_data, color_buffer_data, GL_FILL), 0, 0, 0.3);
 
 }
 
@@ -898,7 +1472,7 @@ void createscore()
 
 
 
-void createCircle (int numberOfSides,int x,int y,int z,int radius){
+VAO* createCircle (int numberOfSides,int x,int y,int z,int radius){
 	int numberOfVertices = numberOfSides + 2;
 
 	GLfloat twicePi = 2.0f * M_PI;
@@ -933,94 +1507,3061 @@ void createCircle (int numberOfSides,int x,int y,int z,int radius){
 
 	}
 
-	circle = create3DObject(GL_TRIANGLE_FAN, numberOfVertices, vertex_buffer_data, color_buffer_data, GL_FILL);
+	return markCircle(create3DObject(GL_TRIANGLE_FAN, numberOfVertices, vertex_buffer_data, color_buffer_data, GL_FILL), x, y, radius);
 
 }
 
 
 
-float camera_rotation_angle = 90;
-double v_x,v_y,a_x = 0.015 ,a_y = 0.03,v = 1;
-double x_proj,y_proj,x_p,y_p,x_p1,x_p2,x_p4,x_p5,x_p6,x_p8,y_p2,y_p3,y_p4,y_p6,y_p7,y_p8;
+/**************************
+ * Frame-time governor    *
+ **************************/
 
-double x_curm;
-double y_curm;
+/* Quality levels, 0 is the cheapest. The governor walks these up and down
+   so that draw() + glfwSwapBuffers stays inside frame_budget */
+#define QUALITY_LEVELS 4
+float render_scale_lod[QUALITY_LEVELS] = {0.5, 0.67, 0.85, 1};
+int circle_sides_lod[QUALITY_LEVELS] = {24, 48, 128, 10000};
+int pellet_cap_lod[QUALITY_LEVELS] = {2, 4, 8, 8};
 
-float rectangle_rotation;
+VAO *ball_lod[QUALITY_LEVELS], *circle_lod[QUALITY_LEVELS], *key_lod[QUALITY_LEVELS], *ex_lod[QUALITY_LEVELS], *small_lod[QUALITY_LEVELS];
 
-/* Render the scene with openGL */
-/* Edit this function according to your assignment */
-void draw ()
+int quality = QUALITY_LEVELS-1, quality_pinned = 0, pellet_cap = 8;
+double frame_budget = 1.0/60;	// seconds, --fps changes it
+double frame_time_avg = 0;
+int over_frames = 0, under_frames = 0, upgrade_delay = 120;
+double last_upgrade_time = -100;
+int post_skip = 0;	// drop post-processing this frame, we are over budget
+
+// Offscreen target used when rendering below window resolution
+GLuint scene_fbo = 0, scene_color = 0, scene_depth = 0;
+int scene_w = 0, scene_h = 0, fb_w = 0, fb_h = 0;
+
+// Pellets are dropped in this order as pellet_cap shrinks: diagonals first, then the axes
+int pellet_rank[9] = {0, 0, 4, 2, 6, 1, 5, 3, 7};
+
+void createCircleLods ()
 {
-	glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	for (int q=0; q < QUALITY_LEVELS; q++) {
+		ball_lod[q] = createball(circle_sides_lod[q],5,5,0,0.5);
+		circle_lod[q] = createCircle(circle_sides_lod[q],5,5,0,3);
+		key_lod[q] = createkey(circle_sides_lod[q]);
+		ex_lod[q] = createexit(circle_sides_lod[q]);
+		small_lod[q] = createsmall(circle_sides_lod[q]);
+		nameObject(ball_lod[q], "ball");
+		nameObject(circle_lod[q], "cannon_base");
+		nameObject(key_lod[q], "key");
+		nameObject(ex_lod[q], "exit");
+		nameObject(small_lod[q], "pellet");
+	}
+}
 
-	// use the loaded shader program
-	// Don't change unless you know what you are doing
-	glUseProgram (programID);
+/* Point the shared circle handles and particle cap at quality level q */
+void applyQuality (int q)
+{
+	quality = q;
+	ball = ball_lod[q];
+	circle = circle_lod[q];
+	key = key_lod[q];
+	ex = ex_lod[q];
+	small = small_lod[q];
+	pellet_cap = pellet_cap_lod[q];
+	printf("governor: quality %d (scale %.2f, circle sides %d, pellets %d)\n", q, render_scale_lod[q], circle_sides_lod[q], pellet_cap);
+}
 
-	// Eye - Location of camera. Don't change unless you are sure!!
-	glm::vec3 eye ( 5*cos(camera_rotation_angle*M_PI/180.0f), 0, 5*sin(camera_rotation_angle*M_PI/180.0f) );
-	// Target - Where is the camera looking at.  Don't change unless you are sure!!
-	glm::vec3 target (0, 0, 0);
-	// Up - Up vector defines tilt of camera.  Don't change unless you are sure!!
-	glm::vec3 up (0, 1, 0);
+/* Bind the scaled offscreen target, or the window if running at full resolution */
+void beginSceneFrame (GLFWwindow* window)
+{
+	glfwGetFramebufferSize(window, &fb_w, &fb_h);
+	float scale = render_scale_lod[quality];
+	if (scale >= 1) {
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, 0, fb_w, fb_h);
+		return;
+	}
 
-	//Compute Camera matrix (view)
-	//Matrices.view = glm::lookAt( eye, target, up ); // Rotating Camera for 3D
-	//  Don't change unless you are sure!!
-	Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0)); // Fixed camera for 2D (ortho) in XY plane
+	int sw = max(1, (int)(fb_w*scale)), sh = max(1, (int)(fb_h*scale));
+	if (scene_fbo == 0) {
+		glGenFramebuffers(1, &scene_fbo);
+		glGenRenderbuffers(1, &scene_color);
+		glGenRenderbuffers(1, &scene_depth);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, scene_fbo);
+	if (sw != scene_w || sh != scene_h) {
+		scene_w = sw;
+		scene_h = sh;
+		glBindRenderbuffer(GL_RENDERBUFFER, scene_color);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, sw, sh);
+		glBindRenderbuffer(GL_RENDERBUFFER, scene_depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, sw, sh);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, scene_color);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, scene_depth);
+	}
+	glViewport(0, 0, scene_w, scene_h);
+}
 
-	// Compute ViewProject matrix as view/camera might not be changed for this frame (basic scenario)
-	//  Don't change unless you are sure!!
-	glm::mat4 VP = Matrices.projection * Matrices.view;
+/* Upscale the offscreen target into the window */
+void presentSceneFrame ()
+{
+	if (render_scale_lod[quality] >= 1)
+		return;
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, scene_fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, scene_w, scene_h, 0, 0, fb_w, fb_h, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-	// Send our transformation to the currently bound shader, in the "MVP" uniform
-	// For each model you render, since the MVP will be different (at least the M part)
-	//  Don't change unless you are sure!!
-	glm::mat4 MVP;	// MVP = Projection * View * Model
+/* Feed one measured frame (draw + swap, in seconds) to the governor.
+   Quality drops after a sustained overrun and only climbs back after a
+   longer stretch under budget; an upgrade that gets undone quickly doubles
+   the wait before the next one so we don't oscillate around the budget */
+void governorUpdate (double frame_time)
+{
+	frame_time_avg = frame_time_avg == 0 ? frame_time : 0.9*frame_time_avg + 0.1*frame_time;
+	if (quality_pinned)
+		return;
 
-	// Load identity to model matrix
-	//Matrices.model = glm::mat4(1.0f);
+	// Post-processing is the first thing to go and comes back as soon as there is room
+	post_skip = frame_time_avg > frame_budget;
 
-	/* Render your scene */
+	double now = glfwGetTime();
+	if (frame_time_avg > 1.2*frame_budget) {
+		over_frames++;
+		under_frames = 0;
+	}
+	else if (frame_time_avg < 1.05*frame_budget) {
+		under_frames++;
+		over_frames = 0;
+	}
+	else {
+		over_frames = under_frames = 0;
+	}
 
-	///glm::mat4 translateTriangle = glm::translate (glm::vec3(-2.0f, 0.0f, 0.0f)); // glTranslatef
-	///glm::mat4 rotateTriangle = glm::rotate((float)(triangle_rotation*M_PI/180.0f), glm::vec3(0,0,1));  // rotate about vector (1,0,0)
-	///glm::mat4 triangleTransform = translateTriangle * rotateTriangle;
-	///Matrices.model *= triangleTransform; 
-	///MVP = VP * Matrices.model; // MVP = p * V * M
+	if (over_frames >= 30 && quality > 0) {
+		if (now - last_upgrade_time < 2)
+			upgrade_delay = min(upgrade_delay*2, 1920);
+		applyQuality(quality-1);
+		over_frames = 0;
+		frame_time_avg = frame_budget;
+	}
+	if (under_frames >= upgrade_delay && quality < QUALITY_LEVELS-1) {
+		applyQuality(quality+1);
+		under_frames = 0;
+		last_upgrade_time = now;
+		frame_time_avg = frame_budget;
+	}
+}
 
-	//  Don't change unless you are sure!!
-	///glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
 
-	// draw3DObject draws the VAO given to it using current MVP matrix
-//	draw3DObject(triangle);
+/**************************
+ * Sprite atlas           *
+ **************************/
 
-	// Pop matrix to undo transformations till last push matrix instead of recomputing model matrix
-	// glPopMatrix ();
-	///rectangle_rotation = rectangle_rotation + increments*rectangle_rot_dir*rectangle_rot_status;
-	for( int i=0;i < arr_obs.size();i++){
-		Matrices.model = glm::mat4(1.0f);
-		glm::mat4 translateRectangle = glm::translate (obst[i]);
-		Matrices.model *=  (translateRectangle );
-		MVP = VP * Matrices.model;
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(arr_obs[i]);
+/* Images packed into one texture by atlaspack at build time (make atlas).
+   Objects that opt in with useSprite() are drawn as textured quads; the
+   quads of a pass are collected and drawn with a single call, and the
+   atlas stays bound to texture unit 1 so no frame rebinds it */
+
+struct SpriteRect {
+	float u0, v0, u1, v1;
+};
+
+map<string, int> sprite_index;
+vector<SpriteRect> sprite_rects;
+const char *atlas_path = "atlas";	// atlas.pam and atlas.txt, --no-atlas to skip
+int sprites_enabled = 0;
+GLuint sprite_tex = 0, sprite_vao = 0, sprite_vbo = 0;
+vector<GLfloat> sprite_verts;	// x, y, z in clip space, u, v, motion kind and phase, model x, y
+#define SPRITE_FLOATS 9
+GLfloat sprite_linear[4];	// linear part of the MVP of the moving sprites queued
+GLint sprite_linear_id = -1;
+Affine2 gl_mvp;	// last matrix handed to the GL backend
+
+/* Read the P7 image written by atlaspack */
+int loadAtlasImage (const char *path, int *width, int *height, vector<unsigned char> &pixels)
+{
+	ifstream in(path, ios::in | ios::binary);
+	string line;
+	int depth = 0;
+	*width = *height = 0;
+	if (!getline(in, line) || line != "P7")
+		return 0;
+	while (getline(in, line) && line != "ENDHDR") {
+		istringstream fields(line);
+		string key;
+		fields >> key;
+		if (key == "WIDTH") fields >> *width;
+		else if (key == "HEIGHT") fields >> *height;
+		else if (key == "DEPTH") fields >> depth;
 	}
+	if (depth != 4 || *width <= 0 || *height <= 0)
+		return 0;
+	pixels.resize(4 * *width * *height);
+	in.read((char*)&pixels[0], pixels.size());
+	return !!in;
+}
 
-	for( int i=0;i < arr_s.size();i++){
-		Matrices.model = glm::mat4(1.0f);
-		glm::mat4 translatesp = glm::translate (s[i]);
-		Matrices.model *=  (translatesp );
-		MVP = VP * Matrices.model;
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(arr_s[i]);
+/* Load the atlas and the sprite shaders, GL backend only */
+void spriteInit ()
+{
+	string base = atlas_path;
+	ifstream rects((base + ".txt").c_str());
+	int width, height, atlas_w, atlas_h;
+	vector<unsigned char> pixels;
+	if (!(rects >> atlas_w >> atlas_h) || !loadAtlasImage((base + ".pam").c_str(), &width, &height, pixels) ||
+	    width != atlas_w || height != atlas_h) {
+		fprintf(stderr, "No sprite atlas at %s.pam/%s.txt, drawing meshes\n", atlas_path, atlas_path);
+		return;
+	}
+	string name;
+	int x, y, w, h;
+	while (rects >> name >> x >> y >> w >> h) {
+		SpriteRect r = {(float)x/width, (float)y/height, (float)(x+w)/width, (float)(y+h)/height};
+		sprite_index[name] = sprite_rects.size();
+		sprite_rects.push_back(r);
 	}
 
-//------------------------------------------------
-	for(int i=0;i<s.size();i++)
-	{
-		if( sqrt( pow((x_proj-s[i][0]+5),2)+pow((y_proj-s[i][1]+5),2) ) < 1 ){
+	glActiveTexture(GL_TEXTURE1);
+	glGenTextures(1, &sprite_tex);
+	glBindTexture(GL_TEXTURE_2D, sprite_tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glActiveTexture(GL_TEXTURE0);
+
+	// Compile the textured variant now rather than on the first flush
+	GLuint textured = shaderVariant(SHADER_TEXTURED).program;
+	sprite_linear_id = glGetUniformLocation(textured, "spriteLinear");
+	glUseProgram(programID);
+
+	glGenVertexArrays(1, &sprite_vao);
+	glGenBuffers(1, &sprite_vbo);
+	bindVertexArray(sprite_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, sprite_vbo);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, SPRITE_FLOATS*sizeof(GLfloat), (void*)0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, SPRITE_FLOATS*sizeof(GLfloat), (void*)(3*sizeof(GLfloat)));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, SPRITE_FLOATS*sizeof(GLfloat), (void*)(5*sizeof(GLfloat)));
+
+	if (gl_debug_labels) {
+		glObjectLabel(GL_TEXTURE, sprite_tex, -1, "sprite_atlas");
+		glObjectLabel(GL_VERTEX_ARRAY, sprite_vao, -1, "sprites");
+		glObjectLabel(GL_BUFFER, sprite_vbo, -1, "sprites");
+	}
+	sprites_enabled = 1;
+	printf("sprites: %d in a %dx%d atlas\n", (int)sprite_rects.size(), width, height);
+}
+
+/* Draw vao as the named sprite stretched over (x0, y0)-(x1, y1) in its model
+   space, if the atlas has one by that name */
+void useSprite (VAO* vao, const char *name, float x0, float y0, float x1, float y1)
+{
+	if (!sprites_enabled)
+		return;
+	map<string, int>::iterator it = sprite_index.find(name);
+	if (it == sprite_index.end())
+		return;
+	vao->Sprite = it->second;
+	vao->SpriteBox[0] = x0;
+	vao->SpriteBox[1] = y0;
+	vao->SpriteBox[2] = x1;
+	vao->SpriteBox[3] = y1;
+}
+
+/* Queue the object's quad under the current MVP */
+void spritePush (VAO* vao)
+{
+	const SpriteRect &r = sprite_rects[vao->Sprite];
+	const float *b = vao->SpriteBox;
+	// Image rows run top down, so the top of the box takes v0
+	float corner[6][4] = {
+		{b[0], b[1], r.u0, r.v1}, {b[2], b[1], r.u1, r.v1}, {b[2], b[3], r.u1, r.v0},
+		{b[0], b[1], r.u0, r.v1}, {b[2], b[3], r.u1, r.v0}, {b[0], b[3], r.u0, r.v0}
+	};
+	// A moving sprite sends its object's origin and leaves the corners to
+	// the vertex shader. Those are only ever translated, so they all share
+	// the view's linear part
+	int moving = vao->Motion[0] != 0;
+	if (moving)
+		memcpy(sprite_linear, gl_mvp.m, sizeof(sprite_linear));
+	for (int i=0; i < 6; i++) {
+		float x, y;
+		affineApply(gl_mvp, moving ? 0 : corner[i][0], moving ? 0 : corner[i][1], x, y);
+		sprite_verts.push_back(x);
+		sprite_verts.push_back(y);
+		sprite_verts.push_back(gl_mvp.t[2]);
+		sprite_verts.push_back(corner[i][2]);
+		sprite_verts.push_back(corner[i][3]);
+		sprite_verts.push_back(vao->Motion[0]);
+		sprite_verts.push_back(vao->Motion[1]);
+		sprite_verts.push_back(moving ? corner[i][0] : 0);
+		sprite_verts.push_back(moving ? corner[i][1] : 0);
+	}
+}
+
+/* Draw every queued sprite in one call */
+void spriteFlush ()
+{
+	if (sprite_verts.empty())
+		return;
+	gl_debug_object = "sprites";
+	glUseProgram(shaderVariant(SHADER_TEXTURED).program);
+	glUniform4fv(sprite_linear_id, 1, sprite_linear);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	bindVertexArray(sprite_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, sprite_vbo);
+	glBufferData(GL_ARRAY_BUFFER, sprite_verts.size()*sizeof(GLfloat), &sprite_verts[0], GL_STREAM_DRAW);
+	viewDrawArrays(GL_TRIANGLES, 0, sprite_verts.size()/SPRITE_FLOATS);
+	sprite_verts.clear();
+	glUseProgram(programID);
+}
+
+
+/**************************
+ * GL backend             *
+ **************************/
+
+void glBackendInit (GLFWwindow* window)
+{
+	// Create and compile our GLSL program from the shaders
+	if (overdraw_enabled)
+		shader_base = SHADER_OVERDRAW;
+	if (split_view)
+		shader_base |= SHADER_VIEWS;
+	const ShaderVariant &plain = shaderVariant(0);
+	programID = plain.program;
+	// Get a handle for our "affine" uniform, the 2D MVP
+	Matrices.AffineID = plain.affine;
+	Matrices.MotionID = plain.motion;
+
+	// Background color of the scene
+	glClearColor (0.2f, 0.2f, 0.2f, 0.2f); // R, G, B, A
+	glClearDepth (1.0f);
+
+	glEnable (GL_DEPTH_TEST);
+	glDepthFunc (GL_LEQUAL);
+
+	cout << "VENDOR: " << glGetString(GL_VENDOR) << endl;
+	cout << "RENDERER: " << glGetString(GL_RENDERER) << endl;
+	cout << "VERSION: " << glGetString(GL_VERSION) << endl;
+	cout << "GLSL: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << endl;
+}
+
+void glBackendClear ()
+{
+	glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	// One uniform per program a frame is all that animation costs the CPU
+	if (animation_enabled)
+		shaderSetTime();
+
+	// use the loaded shader program
+	// Don't change unless you know what you are doing
+	glUseProgram (programID);
+}
+
+/* The vec4 affine[2] uniform of Sample_GL.vert: rows of the 2x3 matrix,
+   depth in the spare slot */
+void affinePack (const Affine2 &mvp, GLfloat affine[8])
+{
+	GLfloat packed[8] = {mvp.m[0], mvp.m[2], mvp.t[0], mvp.t[2], mvp.m[1], mvp.m[3], mvp.t[1], 0};
+	memcpy(affine, packed, sizeof(packed));
+}
+
+void glBackendSetMVP (const Affine2 &mvp)
+{
+	gl_mvp = mvp;
+	// 8 floats in one call
+	GLfloat affine[8];
+	affinePack(mvp, affine);
+	glUniform4fv(Matrices.AffineID, 2, affine);
+}
+
+void glBackendEndFrame (GLFWwindow* window)
+{
+	presentSceneFrame();
+	glfwSwapBuffers(window);
+}
+
+RenderBackend gl_backend = { "gl", glBackendInit, glUpload3DObject, beginSceneFrame, glBackendClear, glBackendSetMVP, glDraw3DObject, glBackendEndFrame };
+
+/**************************
+ * Software rasterizer    *
+ **************************/
+
+/* Pure CPU backend. Draws are recorded during draw(), then at the end of the
+   frame every primitive is transformed, binned into SOFT_TILE sized screen
+   tiles and the tiles are rasterized in parallel. Each tile walks its bin in
+   submission order, so the output does not depend on the thread count */
+#define SOFT_TILE 64
+
+struct SoftPrim {
+	int circle;
+	float x[3], y[3], z[3];	// screen space; a circle uses x[0],y[0],z[0] as centre and x[1],y[1] as radii
+	float r[3], g[3], b[3];
+};
+
+vector<SoftPrim> soft_prims;
+vector< vector<int> > soft_bins;
+vector<unsigned int> soft_color;	// RGBA8, bottom row first like GL
+vector<float> soft_depth;
+int soft_w = 0, soft_h = 0, soft_stride = 0, soft_tiles_x = 0, soft_tiles_y = 0;
+int soft_threads = 0, soft_dump_count = 0;
+
+// Rasterizer workers live for the whole run; each frame bumps
+// soft_pool_frame to wake them and waits for soft_pool_busy to drain.
+// The workers are still waiting at exit, so the lock and conditions are
+// never destroyed (destroying a condition with waiters blocks)
+mutex &soft_pool_lock = *new mutex;
+condition_variable &soft_pool_wake = *new condition_variable, &soft_pool_done = *new condition_variable;
+int soft_pool_frame = 0, soft_pool_busy = 0;
+atomic<int> soft_next_tile(0);
+void softWorker ();
+Affine2 soft_mvp;
+GLuint soft_tex = 0, soft_fbo = 0;
+
+void softInit (GLFWwindow* window)
+{
+	if (soft_threads <= 0)
+		soft_threads = max(1, (int)thread::hardware_concurrency());
+	cout << "RENDERER: software, " << soft_threads << " threads" << endl;
+	// The calling thread rasterizes too, so it needs one fewer worker
+	for (int i=1; i < soft_threads; i++)
+		thread(softWorker).detach();
+	if (gl_available) {
+		glGenTextures(1, &soft_tex);
+		glGenFramebuffers(1, &soft_fbo);
+	}
+}
+
+/* Nothing to upload, just keep the vertices around on the CPU */
+void softUpload (VAO* vao, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data)
+{
+	vao->Vertices.assign(vertex_buffer_data, vertex_buffer_data + 3*vao->NumVertices);
+	vao->Colors.assign(color_buffer_data, color_buffer_data + 3*vao->NumVertices);
+}
+
+void softBeginFrame (GLFWwindow* window)
+{
+	glfwGetFramebufferSize(window, &fb_w, &fb_h);
+	float scale = render_scale_lod[quality];
+	int sw = max(1, (int)(fb_w*scale)), sh = max(1, (int)(fb_h*scale));
+	if (sw != soft_w || sh != soft_h) {
+		soft_w = sw;
+		soft_h = sh;
+		soft_tiles_x = (sw + SOFT_TILE - 1)/SOFT_TILE;
+		soft_tiles_y = (sh + SOFT_TILE - 1)/SOFT_TILE;
+		// Pad to whole tiles so the 4-wide spans never run off a row
+		soft_stride = soft_tiles_x*SOFT_TILE;
+		soft_color.assign(soft_stride*soft_tiles_y*SOFT_TILE, 0);
+		soft_depth.assign(soft_stride*soft_tiles_y*SOFT_TILE, 1);
+		soft_bins.assign(soft_tiles_x*soft_tiles_y, vector<int>());
+		if (soft_tex) {
+			glBindTexture(GL_TEXTURE_2D, soft_tex);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, soft_w, soft_h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, soft_fbo);
+			glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, soft_tex, 0);
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+		}
+	}
+	soft_prims.clear();
+}
+
+void softClear ()
+{
+	// Same as glClearColor (0.2f, 0.2f, 0.2f, 0.2f)
+	fill(soft_color.begin(), soft_color.end(), 0x33333333u);
+	fill(soft_depth.begin(), soft_depth.end(), 1.0f);
+}
+
+void softSetMVP (const Affine2 &mvp)
+{
+	soft_mvp = mvp;
+}
+
+/* Object space to window space, same mapping the GL viewport does */
+void softProject (float x, float y, float z, float &sx, float &sy, float &sz)
+{
+	float px, py;
+	affineApply(soft_mvp, x, y, px, py);
+	sx = (px*0.5f + 0.5f)*soft_w;
+	sy = (py*0.5f + 0.5f)*soft_h;
+	sz = soft_mvp.t[2]*0.5f + 0.5f;
+}
+
+void softPushTriangle (VAO* vao, int a, int b, int c)
+{
+	SoftPrim prim;
+	int idx[3] = {a, b, c};
+	prim.circle = 0;
+	for (int k=0; k < 3; k++) {
+		const GLfloat *v = &vao->Vertices[3*idx[k]], *col = &vao->Colors[3*idx[k]];
+		softProject(v[0], v[1], v[2], prim.x[k], prim.y[k], prim.z[k]);
+		prim.r[k] = col[0];
+		prim.g[k] = col[1];
+		prim.b[k] = col[2];
+	}
+	// Keep every triangle counter-clockwise so the edge tests have one sign
+	float area = (prim.x[1]-prim.x[0])*(prim.y[2]-prim.y[0]) - (prim.y[1]-prim.y[0])*(prim.x[2]-prim.x[0]);
+	if (area == 0)
+		return;
+	if (area < 0) {
+		swap(prim.x[1], prim.x[2]); swap(prim.y[1], prim.y[2]); swap(prim.z[1], prim.z[2]);
+		swap(prim.r[1], prim.r[2]); swap(prim.g[1], prim.g[2]); swap(prim.b[1], prim.b[2]);
+	}
+	soft_prims.push_back(prim);
+}
+
+void softDraw (VAO* vao)
+{
+	if (vao->Vertices.empty())
+		return;
+
+	// Circle fans are drawn as one analytic disc instead of thousands of slivers.
+	// Only translation and uniform scale reach circles in this game, so the
+	// projected shape is an axis aligned ellipse
+	if (vao->IsCircle && vao->PrimitiveMode == GL_TRIANGLE_FAN) {
+		SoftPrim prim;
+		float ex, ey, ez;
+		prim.circle = 1;
+		softProject(vao->CircleX, vao->CircleY, vao->Vertices[2], prim.x[0], prim.y[0], prim.z[0]);
+		softProject(vao->CircleX + vao->CircleRadius, vao->CircleY, vao->Vertices[2], ex, ey, ez);
+		prim.x[1] = fabs(ex - prim.x[0]);
+		softProject(vao->CircleX, vao->CircleY + vao->CircleRadius, vao->Vertices[2], ex, ey, ez);
+		prim.y[1] = fabs(ey - prim.y[0]);
+		prim.r[0] = vao->Colors[0];
+		prim.g[0] = vao->Colors[1];
+		prim.b[0] = vao->Colors[2];
+		soft_prims.push_back(prim);
+		return;
+	}
+
+	if (vao->PrimitiveMode == GL_TRIANGLES) {
+		for (int i=0; i+2 < vao->NumVertices; i+=3)
+			softPushTriangle(vao, i, i+1, i+2);
+	}
+	else if (vao->PrimitiveMode == GL_TRIANGLE_FAN) {
+		for (int i=1; i+1 < vao->NumVertices; i++)
+			softPushTriangle(vao, 0, i, i+1);
+	}
+	else if (vao->PrimitiveMode == GL_TRIANGLE_STRIP) {
+		for (int i=0; i+2 < vao->NumVertices; i++)
+			softPushTriangle(vao, i, i+1, i+2);
+	}
+}
+
+/* Pack four float colours into RGBA8 pixels */
+#ifdef __SSE2__
+static inline __m128i softPack (__m128 r, __m128 g, __m128 b)
+{
+	__m128 k = _mm_set1_ps(255.0f), lo = _mm_setzero_ps(), hi = _mm_set1_ps(1.0f);
+	r = _mm_min_ps(_mm_max_ps(r, lo), hi);
+	g = _mm_min_ps(_mm_max_ps(g, lo), hi);
+	b = _mm_min_ps(_mm_max_ps(b, lo), hi);
+	__m128i ir = _mm_cvtps_epi32(_mm_mul_ps(r, k));
+	__m128i ig = _mm_cvtps_epi32(_mm_mul_ps(g, k));
+	__m128i ib = _mm_cvtps_epi32(_mm_mul_ps(b, k));
+	__m128i px = _mm_or_si128(ir, _mm_slli_epi32(ig, 8));
+	px = _mm_or_si128(px, _mm_slli_epi32(ib, 16));
+	return _mm_or_si128(px, _mm_set1_epi32(0xff000000));
+}
+#endif
+
+static inline unsigned int softPack1 (float r, float g, float b)
+{
+	r = min(max(r, 0.0f), 1.0f);
+	g = min(max(g, 0.0f), 1.0f);
+	b = min(max(b, 0.0f), 1.0f);
+	return 0xff000000u | ((unsigned int)(b*255 + 0.5f) << 16) | ((unsigned int)(g*255 + 0.5f) << 8) | (unsigned int)(r*255 + 0.5f);
+}
+
+/* Rasterize one triangle clipped to the pixel rectangle [x0,x1) x [y0,y1).
+   Pixel centres are sampled, with a top-left rule on shared edges */
+void softRasterTriangle (const SoftPrim &t, int x0, int y0, int x1, int y1)
+{
+	int bx0 = max(x0, (int)floor(min(t.x[0], min(t.x[1], t.x[2]))));
+	int by0 = max(y0, (int)floor(min(t.y[0], min(t.y[1], t.y[2]))));
+	int bx1 = min(x1, (int)ceil(max(t.x[0], max(t.x[1], t.x[2]))));
+	int by1 = min(y1, (int)ceil(max(t.y[0], max(t.y[1], t.y[2]))));
+	if (bx0 >= bx1 || by0 >= by1)
+		return;
+	bx0 &= ~3;	// 4-pixel aligned spans
+
+	// Edge k is opposite vertex k: E = A*x + B*y + C, positive inside
+	float A[3], B[3], C[3];
+	int tl[3];
+	for (int k=0; k < 3; k++) {
+		int i = (k+1)%3, j = (k+2)%3;
+		A[k] = t.y[i] - t.y[j];
+		B[k] = t.x[j] - t.x[i];
+		C[k] = t.x[i]*t.y[j] - t.x[j]*t.y[i];
+		tl[k] = (A[k] > 0) || (A[k] == 0 && B[k] < 0);
+	}
+	float inv_area = 1.0f/(C[0] + C[1] + C[2]);
+
+#ifdef __SSE2__
+	__m128 zero = _mm_setzero_ps();
+	__m128 step = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+	__m128 tlm[3];
+	for (int k=0; k < 3; k++)
+		tlm[k] = _mm_castsi128_ps(_mm_set1_epi32(tl[k] ? -1 : 0));
+	__m128 vinv = _mm_set1_ps(inv_area);
+	for (int y=by0; y < by1; y++) {
+		float py = y + 0.5f;
+		unsigned int *crow = &soft_color[y*soft_stride];
+		float *zrow = &soft_depth[y*soft_stride];
+		for (int x=bx0; x < bx1; x+=4) {
+			__m128 px = _mm_add_ps(_mm_set1_ps((float)x), step);
+			__m128 e[3];
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int k=0; k < 3; k++) {
+				e[k] = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A[k]), px), _mm_set1_ps(B[k]*py + C[k]));
+				__m128 in = _mm_or_ps(_mm_cmpgt_ps(e[k], zero), _mm_and_ps(_mm_cmpeq_ps(e[k], zero), tlm[k]));
+				inside = _mm_and_ps(inside, in);
+			}
+			// Tiles start 4-aligned, only the right end of a span can be ragged
+			inside = _mm_and_ps(inside, _mm_cmplt_ps(px, _mm_set1_ps((float)bx1)));
+			if (_mm_movemask_ps(inside) == 0)
+				continue;
+
+			// a0 + l1*(a1-a0) + l2*(a2-a0) keeps flat attributes exact, so
+			// coplanar objects tie on depth the way they do on the GPU
+			__m128 l1 = _mm_mul_ps(e[1], vinv), l2 = _mm_mul_ps(e[2], vinv);
+			__m128 z = _mm_add_ps(_mm_set1_ps(t.z[0]), _mm_add_ps(_mm_mul_ps(l1, _mm_set1_ps(t.z[1]-t.z[0])), _mm_mul_ps(l2, _mm_set1_ps(t.z[2]-t.z[0]))));
+			__m128 zold = _mm_loadu_ps(zrow + x);
+			__m128 pass = _mm_and_ps(inside, _mm_cmple_ps(z, zold));	// GL_LEQUAL
+			if (_mm_movemask_ps(pass) == 0)
+				continue;
+
+			__m128 r = _mm_add_ps(_mm_set1_ps(t.r[0]), _mm_add_ps(_mm_mul_ps(l1, _mm_set1_ps(t.r[1]-t.r[0])), _mm_mul_ps(l2, _mm_set1_ps(t.r[2]-t.r[0]))));
+			__m128 g = _mm_add_ps(_mm_set1_ps(t.g[0]), _mm_add_ps(_mm_mul_ps(l1, _mm_set1_ps(t.g[1]-t.g[0])), _mm_mul_ps(l2, _mm_set1_ps(t.g[2]-t.g[0]))));
+			__m128 b = _mm_add_ps(_mm_set1_ps(t.b[0]), _mm_add_ps(_mm_mul_ps(l1, _mm_set1_ps(t.b[1]-t.b[0])), _mm_mul_ps(l2, _mm_set1_ps(t.b[2]-t.b[0]))));
+			__m128i mask = _mm_castps_si128(pass);
+			__m128i cold = _mm_loadu_si128((__m128i*)(crow + x));
+			__m128i cnew = softPack(r, g, b);
+			_mm_storeu_si128((__m128i*)(crow + x), _mm_or_si128(_mm_and_si128(mask, cnew), _mm_andnot_si128(mask, cold)));
+			_mm_storeu_ps(zrow + x, _mm_or_ps(_mm_and_ps(pass, z), _mm_andnot_ps(pass, zold)));
+		}
+	}
+#else
+	bx0 = max(bx0, x0);
+	for (int y=by0; y < by1; y++) {
+		float py = y + 0.5f;
+		for (int x=bx0; x < bx1; x++) {
+			float px = x + 0.5f, e[3];
+			int in = 1;
+			for (int k=0; k < 3; k++) {
+				e[k] = A[k]*px + B[k]*py + C[k];
+				in &= e[k] > 0 || (e[k] == 0 && tl[k]);
+			}
+			if (!in)
+				continue;
+			float l1 = e[1]*inv_area, l2 = e[2]*inv_area;
+			float z = t.z[0] + l1*(t.z[1]-t.z[0]) + l2*(t.z[2]-t.z[0]);
+			if (z > soft_depth[y*soft_stride + x])
+				continue;
+			soft_depth[y*soft_stride + x] = z;
+			soft_color[y*soft_stride + x] = softPack1(t.r[0] + l1*(t.r[1]-t.r[0]) + l2*(t.r[2]-t.r[0]), t.g[0] + l1*(t.g[1]-t.g[0]) + l2*(t.g[2]-t.g[0]), t.b[0] + l1*(t.b[1]-t.b[0]) + l2*(t.b[2]-t.b[0]));
+		}
+	}
+#endif
+}
+
+/* Rasterize one flat coloured disc clipped to [x0,x1) x [y0,y1) */
+void softRasterCircle (const SoftPrim &c, int x0, int y0, int x1, int y1)
+{
+	float cx = c.x[0], cy = c.y[0], rx = c.x[1], ry = c.y[1];
+	if (rx <= 0 || ry <= 0)
+		return;
+	int bx0 = max(x0, (int)floor(cx - rx)), bx1 = min(x1, (int)ceil(cx + rx));
+	int by0 = max(y0, (int)floor(cy - ry)), by1 = min(y1, (int)ceil(cy + ry));
+	float iry2 = 1/(ry*ry);
+	unsigned int col = softPack1(c.r[0], c.g[0], c.b[0]);
+	for (int y=by0; y < by1; y++) {
+		float dy = y + 0.5f - cy;
+		float dy2 = dy*dy*iry2;
+		if (dy2 > 1)
+			continue;
+		// Solve the span directly instead of testing every pixel
+		float half = rx*sqrt(1 - dy2);
+		int sx0 = max(bx0, (int)ceil(cx - half - 0.5f)), sx1 = min(bx1, (int)floor(cx + half - 0.5f) + 1);
+		unsigned int *crow = &soft_color[y*soft_stride];
+		float *zrow = &soft_depth[y*soft_stride];
+		for (int x=sx0; x < sx1; x++) {
+			if (c.z[0] <= zrow[x]) {
+				zrow[x] = c.z[0];
+				crow[x] = col;
+			}
+		}
+	}
+}
+
+void softRasterTiles (atomic<int> *next_tile)
+{
+	int count = soft_tiles_x*soft_tiles_y;
+	for (int tile = (*next_tile)++; tile < count; tile = (*next_tile)++) {
+		int tx = tile % soft_tiles_x, ty = tile / soft_tiles_x;
+		int x0 = tx*SOFT_TILE, y0 = ty*SOFT_TILE;
+		int x1 = min(x0 + SOFT_TILE, soft_w), y1 = min(y0 + SOFT_TILE, soft_h);
+		const vector<int> &bin = soft_bins[tile];
+		for (size_t i=0; i < bin.size(); i++) {
+			const SoftPrim &prim = soft_prims[bin[i]];
+			if (prim.circle)
+				softRasterCircle(prim, x0, y0, x1, y1);
+			else
+				softRasterTriangle(prim, x0, y0, x1, y1);
+		}
+	}
+}
+
+/* Rasterize the tiles of every frame softRasterize() hands out */
+void softWorker ()
+{
+	int seen = 0;
+	for (;;) {
+		{
+			unique_lock<mutex> lock(soft_pool_lock);
+			while (soft_pool_frame == seen)
+				soft_pool_wake.wait(lock);
+			seen = soft_pool_frame;
+		}
+		softRasterTiles(&soft_next_tile);
+		lock_guard<mutex> lock(soft_pool_lock);
+		if (--soft_pool_busy == 0)
+			soft_pool_done.notify_one();
+	}
+}
+
+/* Bin everything recorded this frame and rasterize the tiles on all threads */
+void softRasterize ()
+{
+	for (size_t t=0; t < soft_bins.size(); t++)
+		soft_bins[t].clear();
+	for (size_t i=0; i < soft_prims.size(); i++) {
+		const SoftPrim &p = soft_prims[i];
+		float mnx, mny, mxx, mxy;
+		if (p.circle) {
+			mnx = p.x[0] - p.x[1]; mxx = p.x[0] + p.x[1];
+			mny = p.y[0] - p.y[1]; mxy = p.y[0] + p.y[1];
+		}
+		else {
+			mnx = min(p.x[0], min(p.x[1], p.x[2])); mxx = max(p.x[0], max(p.x[1], p.x[2]));
+			mny = min(p.y[0], min(p.y[1], p.y[2])); mxy = max(p.y[0], max(p.y[1], p.y[2]));
+		}
+		int tx0 = max(0, (int)floor(mnx)/SOFT_TILE), tx1 = min(soft_tiles_x-1, (int)ceil(mxx)/SOFT_TILE);
+		int ty0 = max(0, (int)floor(mny)/SOFT_TILE), ty1 = min(soft_tiles_y-1, (int)ceil(mxy)/SOFT_TILE);
+		if (mxx < 0 || mxy < 0 || mnx >= soft_w || mny >= soft_h)
+			continue;
+		for (int ty=ty0; ty <= ty1; ty++)
+			for (int tx=tx0; tx <= tx1; tx++)
+				soft_bins[ty*soft_tiles_x + tx].push_back(i);
+	}
+
+	soft_next_tile = 0;
+	{
+		lock_guard<mutex> lock(soft_pool_lock);
+		soft_pool_busy = soft_threads - 1;
+		soft_pool_frame++;
+	}
+	soft_pool_wake.notify_all();
+	softRasterTiles(&soft_next_tile);
+	unique_lock<mutex> lock(soft_pool_lock);
+	while (soft_pool_busy > 0)
+		soft_pool_done.wait(lock);
+}
+
+/* Write RGB rows, bottom row first as GL stores them, as a binary PPM */
+int writePPM (const char *path, int w, int h, const vector<unsigned char> &rgb)
+{
+	FILE *f = fopen(path, "wb");
+	if (!f) {
+		fprintf(stderr, "Error: could not write %s\n", path);
+		return 0;
+	}
+	fprintf(f, "P6\n%d %d\n255\n", w, h);
+	for (int y=h-1; y >= 0; y--)
+		fwrite(&rgb[3*y*w], 1, 3*w, f);
+	fclose(f);
+	return 1;
+}
+
+/* The software framebuffer as RGB rows, bottom row first */
+void softPixels (vector<unsigned char> &rgb)
+{
+	rgb.resize(3*soft_w*soft_h);
+	for (int y=0; y < soft_h; y++) {
+		unsigned char *row = &rgb[3*y*soft_w];
+		for (int x=0; x < soft_w; x++) {
+			unsigned int px = soft_color[y*soft_stride + x];
+			row[3*x] = px & 0xff;
+			row[3*x+1] = (px >> 8) & 0xff;
+			row[3*x+2] = (px >> 16) & 0xff;
+		}
+	}
+}
+
+/* Write the software framebuffer as a binary PPM */
+void softDump (const char *path)
+{
+	vector<unsigned char> rgb;
+	softPixels(rgb);
+	if (writePPM(path, soft_w, soft_h, rgb))
+		printf("wrote %s\n", path);
+}
+
+void softEndFrame (GLFWwindow* window)
+{
+	softRasterize();
+	if (dump_requested) {
+		char path[32];
+		sprintf(path, "frame_%04d.ppm", soft_dump_count++);
+		softDump(path);
+		dump_requested = 0;
+	}
+	if (!soft_tex)
+		return;
+	// Present through GL when there is a context: upload and blit to the window
+	glBindTexture(GL_TEXTURE_2D, soft_tex);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, soft_stride);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, soft_w, soft_h, GL_RGBA, GL_UNSIGNED_BYTE, &soft_color[0]);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, soft_fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glViewport(0, 0, fb_w, fb_h);
+	glBlitFramebuffer(0, 0, soft_w, soft_h, 0, 0, fb_w, fb_h, GL_COLOR_BUFFER_BIT, soft_w == fb_w ? GL_NEAREST : GL_LINEAR);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glfwSwapBuffers(window);
+}
+
+RenderBackend soft_backend = { "soft", softInit, softUpload, softBeginFrame, softClear, softSetMVP, softDraw, softEndFrame };
+
+/**************************
+ * Null backend           *
+ **************************/
+
+/* Renders nothing and only counts what it was asked to do, so the time left
+   in draw() is pure CPU: matrix building, collision and HUD logic */
+struct DrawCounts {
+	long clears, matrices, draws, vertices;
+} draw_counts;
+
+void nullInit (GLFWwindow* window)
+{
+	cout << "RENDERER: null, draw calls are only counted" << endl;
+}
+
+void nullUpload (VAO* vao, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data)
+{
+}
+
+/* Nothing to bind, but keep the window size that sceneWidth() and the
+   tile LOD choice read, as the other backends do */
+void nullBeginFrame (GLFWwindow* window)
+{
+	glfwGetFramebufferSize(window, &fb_w, &fb_h);
+}
+
+void nullClear ()
+{
+	draw_counts.clears++;
+}
+
+void nullSetMVP (const Affine2 &mvp)
+{
+	draw_counts.matrices++;
+}
+
+void nullDraw (VAO* vao)
+{
+	draw_counts.draws++;
+	draw_counts.vertices += vao->NumVertices;
+}
+
+void nullEndFrame (GLFWwindow* window)
+{
+}
+
+RenderBackend null_backend = { "null", nullInit, nullUpload, nullBeginFrame, nullClear, nullSetMVP, nullDraw, nullEndFrame };
+
+/**************************
+ * Transform cache        *
+ **************************/
+
+/* World and MVP matrices of objects that rarely move. Each node keeps its
+   local matrix relative to its parent and caches world = parent * local and
+   mvp = VP * world; they are only rebuilt when the node, one of its
+   parents or the VP matrix changed since they were last used */
+
+struct XformNode {
+	Affine2 local, world, mvp;
+	int parent;	// index, -1 for a root
+	int dirty;	// local changed since world was built
+	unsigned world_serial;	// bumped every time world is rebuilt
+	unsigned parent_serial;	// parent's world_serial that world was built from
+	unsigned vp_serial;	// VP that mvp was built from
+	unsigned mvp_world_serial;	// world_serial that mvp was built from
+};
+
+vector<XformNode> xform_nodes;
+Affine2 xform_vp;
+unsigned xform_vp_serial = 1;
+long xform_rebuilt = 0;	// world and mvp products, for --stats
+
+int xformNode (int parent, const Affine2 &local)
+{
+	XformNode node;
+	node.local = local;
+	node.parent = parent;
+	node.dirty = 1;
+	node.world_serial = 0;
+	node.parent_serial = node.vp_serial = node.mvp_world_serial = 0;
+	xform_nodes.push_back(node);
+	return xform_nodes.size() - 1;
+}
+
+void xformSetLocal (int i, const Affine2 &local)
+{
+	xform_nodes[i].local = local;
+	xform_nodes[i].dirty = 1;
+}
+
+/* Drop nodes added after the first n, e.g. the tiles of the last level */
+void xformTruncate (int n)
+{
+	xform_nodes.resize(n);
+}
+
+/* Start of a pass: a different VP invalidates every cached mvp */
+void xformSetVP (const Affine2 &VP)
+{
+	if (!(VP == xform_vp)) {
+		xform_vp = VP;
+		xform_vp_serial++;
+	}
+}
+
+const Affine2& xformWorld (int i)
+{
+	XformNode &node = xform_nodes[i];
+	if (node.parent >= 0) {
+		const Affine2 &parent_world = xformWorld(node.parent);
+		unsigned serial = xform_nodes[node.parent].world_serial;
+		if (node.dirty || node.parent_serial != serial) {
+			node.world = parent_world * node.local;
+			node.parent_serial = serial;
+			node.dirty = 0;
+			node.world_serial++;
+			xform_rebuilt++;
+		}
+	}
+	else if (node.dirty) {
+		node.world = node.local;
+		node.dirty = 0;
+		node.world_serial++;
+	}
+	return node.world;
+}
+
+const Affine2& xformMVP (int i)
+{
+	const Affine2 &world = xformWorld(i);
+	XformNode &node = xform_nodes[i];
+	if (node.vp_serial != xform_vp_serial || node.mvp_world_serial != node.world_serial) {
+		node.mvp = xform_vp * world;
+		node.vp_serial = xform_vp_serial;
+		node.mvp_world_serial = node.world_serial;
+		xform_rebuilt++;
+	}
+	return node.mvp;
+}
+
+
+/**************************
+ * Frame statistics       *
+ **************************/
+
+/* Time spent inside draw() against the whole frame, per backend. Run the
+   same scene with --renderer gl and --renderer null to see how much of the
+   frame is driver and GPU */
+int show_stats = 0, frame_limit = 0;
+long frames_drawn = 0;
+double stat_draw_time = 0, stat_frame_time = 0, total_draw_time = 0, total_frame_time = 0;
+int stat_frames = 0;
+DrawCounts last_counts;
+long last_xform_rebuilt = 0;
+
+void statsUpdate (double draw_time, double frame_time)
+{
+	frames_drawn++;
+	stat_frames++;
+	stat_draw_time += draw_time;
+	stat_frame_time += frame_time;
+	total_draw_time += draw_time;
+	total_frame_time += frame_time;
+}
+
+/* Print the averages since the last report */
+void statsReport ()
+{
+	if (!show_stats || stat_frames == 0)
+		return;
+	printf("%s: %d frames, draw() %.3f ms, frame %.3f ms", backend->name, stat_frames, 1000*stat_draw_time/stat_frames, 1000*stat_frame_time/stat_frames);
+	if (backend == &null_backend) {
+		printf(", per frame %ld draws, %ld vertices, %ld matrices",
+				(draw_counts.draws - last_counts.draws)/stat_frames,
+				(draw_counts.vertices - last_counts.vertices)/stat_frames,
+				(draw_counts.matrices - last_counts.matrices)/stat_frames);
+		last_counts = draw_counts;
+	}
+	printf(", %ld cached matrices rebuilt per frame", (xform_rebuilt - last_xform_rebuilt)/stat_frames);
+	last_xform_rebuilt = xform_rebuilt;
+	printf("\n");
+	stat_frames = 0;
+	stat_draw_time = stat_frame_time = 0;
+}
+
+
+/**************************
+ * GPU pass timing        *
+ **************************/
+
+/* On the GL backend each frame is split into passes and every pass is
+   wrapped in a GL_TIME_ELAPSED query, plus vertex and fragment shader
+   invocation counts when ARB_pipeline_statistics_query is there (samples
+   passed otherwise). A pass can be entered several times a frame and its
+   segments are summed. A frame's queries are read GPU_FRAMES frames later;
+   if they are still in flight that frame is simply not measured, so the
+   CPU never waits on the GPU */
+#define PASS_WORLD 0
+#define PASS_EFFECTS 1
+#define PASS_HUD 2
+#define PASS_LIGHTING 3
+#define PASS_POST 4
+#define PASS_COUNT 5
+const char *pass_name[PASS_COUNT] = {"world", "effects", "hud", "lighting", "post"};
+
+#define GPU_FRAMES 3	// frames in flight before a slot is read back
+#define GPU_SEGMENTS 24	// pass switches measured per frame
+
+struct GpuSegment {
+	int pass;
+	GLuint query[3];	// one per gpu_target
+};
+
+struct GpuFrame {
+	GpuSegment seg[GPU_SEGMENTS];
+	int count, pending;
+};
+
+int gpu_enabled = 0;
+GLenum gpu_target[3];	// time, fragments, and vertices when available
+int gpu_targets = 0;
+GpuFrame gpu_frames[GPU_FRAMES];
+long gpu_frame_count = 0;
+int gpu_slot = -1;	// frame being recorded, -1 when this one is not measured
+int gpu_open = -1;	// pass whose queries are running
+
+// Sums since the last report, and how many measured frames ran each pass
+double gpu_pass_ms[PASS_COUNT];
+unsigned long long gpu_pass_fragments[PASS_COUNT], gpu_pass_vertices[PASS_COUNT];
+int gpu_pass_frames[PASS_COUNT];
+int gpu_frames_read = 0;
+
+void gpuInit ()
+{
+	if (backend != &gl_backend)
+		return;
+	gpu_enabled = 1;
+	gpu_target[gpu_targets++] = GL_TIME_ELAPSED;
+	if (GLAD_GL_ARB_pipeline_statistics_query) {
+		gpu_target[gpu_targets++] = GL_FRAGMENT_SHADER_INVOCATIONS_ARB;
+		gpu_target[gpu_targets++] = GL_VERTICES_SUBMITTED_ARB;
+	}
+	else
+		gpu_target[gpu_targets++] = GL_SAMPLES_PASSED;
+	for (int f=0; f < GPU_FRAMES; f++) {
+		for (int s=0; s < GPU_SEGMENTS; s++)
+			glGenQueries(gpu_targets, gpu_frames[f].seg[s].query);
+	}
+}
+
+/* Add a finished frame to the sums, or return 0 if the GPU is not done with it */
+int gpuCollect (GpuFrame &fr)
+{
+	for (int s=0; s < fr.count; s++) {
+		for (int k=0; k < gpu_targets; k++) {
+			GLint ready = 0;
+			glGetQueryObjectiv(fr.seg[s].query[k], GL_QUERY_RESULT_AVAILABLE, &ready);
+			if (!ready)
+				return 0;
+		}
+	}
+	int seen[PASS_COUNT] = {0};
+	for (int s=0; s < fr.count; s++) {
+		int p = fr.seg[s].pass;
+		GLuint64 result[3] = {0, 0, 0};
+		for (int k=0; k < gpu_targets; k++)
+			glGetQueryObjectui64v(fr.seg[s].query[k], GL_QUERY_RESULT, &result[k]);
+		gpu_pass_ms[p] += result[0] / 1e6;
+		gpu_pass_fragments[p] += result[1];
+		gpu_pass_vertices[p] += result[2];
+		seen[p] = 1;
+	}
+	for (int p=0; p < PASS_COUNT; p++)
+		gpu_pass_frames[p] += seen[p];
+	gpu_frames_read++;
+	fr.pending = 0;
+	return 1;
+}
+
+void gpuFrameBegin ()
+{
+	gpu_slot = -1;
+	if (!gpu_enabled)
+		return;
+	int slot = gpu_frame_count++ % GPU_FRAMES;
+	if (gpu_frames[slot].pending && !gpuCollect(gpu_frames[slot]))
+		return;
+	gpu_frames[slot].count = 0;
+	gpu_slot = slot;
+}
+
+/* Close the running pass and start measuring the given one, -1 for none */
+void gpuPass (int pass)
+{
+	if (gpu_slot < 0 || pass == gpu_open)
+		return;
+	GpuFrame &fr = gpu_frames[gpu_slot];
+	if (gpu_open >= 0) {
+		for (int k=0; k < gpu_targets; k++)
+			glEndQuery(gpu_target[k]);
+		gpu_open = -1;
+	}
+	if (pass < 0 || fr.count == GPU_SEGMENTS)
+		return;
+	GpuSegment &seg = fr.seg[fr.count++];
+	seg.pass = pass;
+	for (int k=0; k < gpu_targets; k++)
+		glBeginQuery(gpu_target[k], seg.query[k]);
+	gpu_open = pass;
+}
+
+void gpuFrameEnd ()
+{
+	gpuPass(-1);
+	if (gpu_slot >= 0)
+		gpu_frames[gpu_slot].pending = gpu_frames[gpu_slot].count > 0;
+}
+
+/* Average GPU ms of a pass over the measured frames that ran it, -1 if none */
+double gpuPassTime (int pass)
+{
+	if (gpu_pass_frames[pass] == 0)
+		return -1;
+	return gpu_pass_ms[pass] / gpu_pass_frames[pass];
+}
+
+/* Wait for the GPU and read back every frame still in flight, so the sums
+   cover all frames drawn so far */
+void gpuDrain ()
+{
+	if (!gpu_enabled)
+		return;
+	glFinish();
+	for (int f=0; f < GPU_FRAMES; f++) {
+		if (gpu_frames[f].pending)
+			gpuCollect(gpu_frames[f]);
+	}
+}
+
+/* GPU ms of all passes read back since the last reset */
+double gpuTotalTime ()
+{
+	double total = 0;
+	for (int p=0; p < PASS_COUNT; p++)
+		total += gpu_pass_ms[p];
+	return total;
+}
+
+void gpuReset ()
+{
+	memset(gpu_pass_ms, 0, sizeof(gpu_pass_ms));
+	memset(gpu_pass_fragments, 0, sizeof(gpu_pass_fragments));
+	memset(gpu_pass_vertices, 0, sizeof(gpu_pass_vertices));
+	memset(gpu_pass_frames, 0, sizeof(gpu_pass_frames));
+	gpu_frames_read = 0;
+}
+
+/* Print the per pass averages since the last report and start over */
+void gpuReport ()
+{
+	if (!gpu_enabled)
+		return;
+	if (show_stats && gpu_frames_read > 0) {
+		printf("gpu: %d frames measured", gpu_frames_read);
+		for (int p=0; p < PASS_COUNT; p++) {
+			int frames = gpu_pass_frames[p];
+			if (frames == 0)
+				continue;
+			printf(", %s %.3f ms", pass_name[p], gpuPassTime(p));
+			if (gpu_targets == 3)
+				printf(" %llu vertices %llu fragments", gpu_pass_vertices[p]/frames, gpu_pass_fragments[p]/frames);
+			else
+				printf(" %llu samples", gpu_pass_fragments[p]/frames);
+		}
+		printf("\n");
+	}
+	gpuReset();
+}
+
+
+/**************************
+ * GL command capture     *
+ **************************/
+
+/* --capture FILE N swaps glad's function pointers for recording wrappers,
+   so every GL call the game makes from startup through N frames is written
+   to FILE (format in glcapture.h) before being forwarded to the driver.
+   The replay tool plays it back without input, physics or the window loop */
+FILE *cap_file = NULL;
+int cap_frames_left = 0, cap_unpack_row_length = 0, cap_unpack_alignment = 4;
+
+void capOp (int op) { unsigned char b = op; fwrite(&b, 1, 1, cap_file); }
+void capU32 (unsigned int v) { fwrite(&v, 4, 1, cap_file); }
+void capF32 (float v) { fwrite(&v, 4, 1, cap_file); }
+void capU64 (unsigned long long v) { fwrite(&v, 8, 1, cap_file); }
+void capBytes (const void *data, unsigned int size)
+{
+	capU32(data ? size : 0);
+	if (data && size)
+		fwrite(data, 1, size, cap_file);
+}
+
+/* Bytes glTex(Sub)Image2D reads for the current unpack state */
+unsigned int capImageSize (GLsizei width, GLsizei height, GLenum format, GLenum type)
+{
+	int comps = format == GL_RGBA ? 4 : format == GL_RGB ? 3 : format == GL_RG ? 2 : 1;
+	int size = type == GL_FLOAT ? 4 : (type == GL_HALF_FLOAT ? 2 : 1);
+	unsigned int bpp = comps*size;
+	unsigned int row = (cap_unpack_row_length ? cap_unpack_row_length : width)*bpp;
+	row = (row + cap_unpack_alignment - 1)/cap_unpack_alignment*cap_unpack_alignment;
+	return height > 0 ? row*(height-1) + width*bpp : 0;
+}
+
+// The driver's entry points while capture is installed
+PFNGLCLEARPROC real_glClear;
+PFNGLCLEARCOLORPROC real_glClearColor;
+PFNGLCLEARDEPTHPROC real_glClearDepth;
+PFNGLENABLEPROC real_glEnable;
+PFNGLDISABLEPROC real_glDisable;
+PFNGLDEPTHFUNCPROC real_glDepthFunc;
+PFNGLBLENDFUNCPROC real_glBlendFunc;
+PFNGLVIEWPORTPROC real_glViewport;
+PFNGLPOLYGONMODEPROC real_glPolygonMode;
+PFNGLPIXELSTOREIPROC real_glPixelStorei;
+PFNGLCREATESHADERPROC real_glCreateShader;
+PFNGLSHADERSOURCEPROC real_glShaderSource;
+PFNGLCOMPILESHADERPROC real_glCompileShader;
+PFNGLDELETESHADERPROC real_glDeleteShader;
+PFNGLCREATEPROGRAMPROC real_glCreateProgram;
+PFNGLATTACHSHADERPROC real_glAttachShader;
+PFNGLLINKPROGRAMPROC real_glLinkProgram;
+PFNGLUSEPROGRAMPROC real_glUseProgram;
+PFNGLGETUNIFORMLOCATIONPROC real_glGetUniformLocation;
+PFNGLUNIFORMMATRIX4FVPROC real_glUniformMatrix4fv;
+PFNGLUNIFORM1IPROC real_glUniform1i;
+PFNGLUNIFORM1FPROC real_glUniform1f;
+PFNGLUNIFORM2FPROC real_glUniform2f;
+PFNGLUNIFORM4FPROC real_glUniform4f;
+PFNGLUNIFORM4FVPROC real_glUniform4fv;
+PFNGLGENVERTEXARRAYSPROC real_glGenVertexArrays;
+PFNGLBINDVERTEXARRAYPROC real_glBindVertexArray;
+PFNGLGENBUFFERSPROC real_glGenBuffers;
+PFNGLBINDBUFFERPROC real_glBindBuffer;
+PFNGLBUFFERDATAPROC real_glBufferData;
+PFNGLBUFFERSUBDATAPROC real_glBufferSubData;
+PFNGLVERTEXATTRIBPOINTERPROC real_glVertexAttribPointer;
+PFNGLENABLEVERTEXATTRIBARRAYPROC real_glEnableVertexAttribArray;
+PFNGLDISABLEVERTEXATTRIBARRAYPROC real_glDisableVertexAttribArray;
+PFNGLVERTEXATTRIBDIVISORPROC real_glVertexAttribDivisor;
+PFNGLDRAWARRAYSPROC real_glDrawArrays;
+PFNGLDRAWARRAYSINSTANCEDPROC real_glDrawArraysInstanced;
+PFNGLGENTEXTURESPROC real_glGenTextures;
+PFNGLBINDTEXTUREPROC real_glBindTexture;
+PFNGLACTIVETEXTUREPROC real_glActiveTexture;
+PFNGLTEXPARAMETERIPROC real_glTexParameteri;
+PFNGLTEXIMAGE2DPROC real_glTexImage2D;
+PFNGLTEXSUBIMAGE2DPROC real_glTexSubImage2D;
+PFNGLGENFRAMEBUFFERSPROC real_glGenFramebuffers;
+PFNGLBINDFRAMEBUFFERPROC real_glBindFramebuffer;
+PFNGLFRAMEBUFFERTEXTURE2DPROC real_glFramebufferTexture2D;
+PFNGLGENRENDERBUFFERSPROC real_glGenRenderbuffers;
+PFNGLBINDRENDERBUFFERPROC real_glBindRenderbuffer;
+PFNGLRENDERBUFFERSTORAGEPROC real_glRenderbufferStorage;
+PFNGLFRAMEBUFFERRENDERBUFFERPROC real_glFramebufferRenderbuffer;
+PFNGLBLITFRAMEBUFFERPROC real_glBlitFramebuffer;
+PFNGLTRANSFORMFEEDBACKVARYINGSPROC real_glTransformFeedbackVaryings;
+PFNGLBINDBUFFERBASEPROC real_glBindBufferBase;
+PFNGLBEGINTRANSFORMFEEDBACKPROC real_glBeginTransformFeedback;
+PFNGLENDTRANSFORMFEEDBACKPROC real_glEndTransformFeedback;
+PFNGLGENTRANSFORMFEEDBACKSPROC real_glGenTransformFeedbacks;
+PFNGLBINDTRANSFORMFEEDBACKPROC real_glBindTransformFeedback;
+PFNGLDRAWTRANSFORMFEEDBACKPROC real_glDrawTransformFeedback;
+
+void APIENTRY cap_glClear (GLbitfield mask) { capOp(CAP_CLEAR); capU32(mask); real_glClear(mask); }
+void APIENTRY cap_glClearColor (GLfloat r, GLfloat g, GLfloat b, GLfloat a) { capOp(CAP_CLEAR_COLOR); capF32(r); capF32(g); capF32(b); capF32(a); real_glClearColor(r, g, b, a); }
+void APIENTRY cap_glClearDepth (GLdouble d) { capOp(CAP_CLEAR_DEPTH); capF32(d); real_glClearDepth(d); }
+void APIENTRY cap_glEnable (GLenum cap) { capOp(CAP_ENABLE); capU32(cap); real_glEnable(cap); }
+void APIENTRY cap_glDisable (GLenum cap) { capOp(CAP_DISABLE); capU32(cap); real_glDisable(cap); }
+void APIENTRY cap_glDepthFunc (GLenum func) { capOp(CAP_DEPTH_FUNC); capU32(func); real_glDepthFunc(func); }
+void APIENTRY cap_glBlendFunc (GLenum sfactor, GLenum dfactor) { capOp(CAP_BLEND_FUNC); capU32(sfactor); capU32(dfactor); real_glBlendFunc(sfactor, dfactor); }
+void APIENTRY cap_glViewport (GLint x, GLint y, GLsizei w, GLsizei h) { capOp(CAP_VIEWPORT); capU32(x); capU32(y); capU32(w); capU32(h); real_glViewport(x, y, w, h); }
+void APIENTRY cap_glPolygonMode (GLenum face, GLenum mode) { capOp(CAP_POLYGON_MODE); capU32(face); capU32(mode); real_glPolygonMode(face, mode); }
+
+void APIENTRY cap_glPixelStorei (GLenum pname, GLint param)
+{
+	if (pname == GL_UNPACK_ROW_LENGTH)
+		cap_unpack_row_length = param;
+	if (pname == GL_UNPACK_ALIGNMENT)
+		cap_unpack_alignment = param;
+	capOp(CAP_PIXEL_STOREI); capU32(pname); capU32(param);
+	real_glPixelStorei(pname, param);
+}
+
+GLuint APIENTRY cap_glCreateShader (GLenum type)
+{
+	GLuint shader = real_glCreateShader(type);
+	capOp(CAP_CREATE_SHADER); capU32(type); capU32(shader);
+	return shader;
+}
+
+void APIENTRY cap_glShaderSource (GLuint shader, GLsizei count, const GLchar *const *string, const GLint *length)
+{
+	std::string source;
+	for (int i=0; i < count; i++)
+		source += length && length[i] >= 0 ? std::string(string[i], length[i]) : std::string(string[i]);
+	capOp(CAP_SHADER_SOURCE); capU32(shader); capBytes(source.c_str(), source.size());
+	real_glShaderSource(shader, count, string, length);
+}
+
+void APIENTRY cap_glCompileShader (GLuint shader) { capOp(CAP_COMPILE_SHADER); capU32(shader); real_glCompileShader(shader); }
+void APIENTRY cap_glDeleteShader (GLuint shader) { capOp(CAP_DELETE_SHADER); capU32(shader); real_glDeleteShader(shader); }
+
+GLuint APIENTRY cap_glCreateProgram ()
+{
+	GLuint program = real_glCreateProgram();
+	capOp(CAP_CREATE_PROGRAM); capU32(program);
+	return program;
+}
+
+void APIENTRY cap_glAttachShader (GLuint program, GLuint shader) { capOp(CAP_ATTACH_SHADER); capU32(program); capU32(shader); real_glAttachShader(program, shader); }
+void APIENTRY cap_glLinkProgram (GLuint program) { capOp(CAP_LINK_PROGRAM); capU32(program); real_glLinkProgram(program); }
+void APIENTRY cap_glUseProgram (GLuint program) { capOp(CAP_USE_PROGRAM); capU32(program); real_glUseProgram(program); }
+
+GLint APIENTRY cap_glGetUniformLocation (GLuint program, const GLchar *name)
+{
+	GLint location = real_glGetUniformLocation(program, name);
+	capOp(CAP_GET_UNIFORM_LOCATION); capU32(program); capBytes(name, strlen(name)); capU32(location);
+	return location;
+}
+
+void APIENTRY cap_glUniformMatrix4fv (GLint location, GLsizei count, GLboolean transpose, const GLfloat *value)
+{
+	capOp(CAP_UNIFORM_MATRIX4FV); capU32(location); capU32(count); capU32(transpose); capBytes(value, 16*count*sizeof(GLfloat));
+	real_glUniformMatrix4fv(location, count, transpose, value);
+}
+
+void APIENTRY cap_glUniform1i (GLint location, GLint v0) { capOp(CAP_UNIFORM1I); capU32(location); capU32(v0); real_glUniform1i(location, v0); }
+void APIENTRY cap_glUniform1f (GLint location, GLfloat v0) { capOp(CAP_UNIFORM1F); capU32(location); capF32(v0); real_glUniform1f(location, v0); }
+void APIENTRY cap_glUniform2f (GLint location, GLfloat v0, GLfloat v1) { capOp(CAP_UNIFORM2F); capU32(location); capF32(v0); capF32(v1); real_glUniform2f(location, v0, v1); }
+void APIENTRY cap_glUniform4f (GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3) { capOp(CAP_UNIFORM4F); capU32(location); capF32(v0); capF32(v1); capF32(v2); capF32(v3); real_glUniform4f(location, v0, v1, v2, v3); }
+void APIENTRY cap_glUniform4fv (GLint location, GLsizei count, const GLfloat *value)
+{
+	capOp(CAP_UNIFORM4FV); capU32(location); capU32(count); capBytes(value, 4*count*sizeof(GLfloat));
+	real_glUniform4fv(location, count, value);
+}
+
+/* glGen* all share a shape: forward, then store the names we got back */
+void capGenNames (int op, GLsizei n, const GLuint *names)
+{
+	capOp(op); capU32(n);
+	for (int i=0; i < n; i++)
+		capU32(names[i]);
+}
+
+void APIENTRY cap_glGenVertexArrays (GLsizei n, GLuint *arrays) { real_glGenVertexArrays(n, arrays); capGenNames(CAP_GEN_VERTEX_ARRAYS, n, arrays); }
+void APIENTRY cap_glBindVertexArray (GLuint array) { capOp(CAP_BIND_VERTEX_ARRAY); capU32(array); real_glBindVertexArray(array); }
+void APIENTRY cap_glGenBuffers (GLsizei n, GLuint *buffers) { real_glGenBuffers(n, buffers); capGenNames(CAP_GEN_BUFFERS, n, buffers); }
+void APIENTRY cap_glBindBuffer (GLenum target, GLuint buffer) { capOp(CAP_BIND_BUFFER); capU32(target); capU32(buffer); real_glBindBuffer(target, buffer); }
+
+void APIENTRY cap_glBufferData (GLenum target, GLsizeiptr size, const void *data, GLenum usage)
+{
+	capOp(CAP_BUFFER_DATA); capU32(target); capU32(size); capBytes(data, size); capU32(usage);
+	real_glBufferData(target, size, data, usage);
+}
+
+void APIENTRY cap_glBufferSubData (GLenum target, GLintptr offset, GLsizeiptr size, const void *data)
+{
+	capOp(CAP_BUFFER_SUB_DATA); capU32(target); capU64(offset); capBytes(data, size);
+	real_glBufferSubData(target, offset, size, data);
+}
+
+void APIENTRY cap_glVertexAttribPointer (GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void *pointer)
+{
+	capOp(CAP_VERTEX_ATTRIB_POINTER); capU32(index); capU32(size); capU32(type); capU32(normalized); capU32(stride); capU64((size_t)pointer);
+	real_glVertexAttribPointer(index, size, type, normalized, stride, pointer);
+}
+
+void APIENTRY cap_glEnableVertexAttribArray (GLuint index) { capOp(CAP_ENABLE_VERTEX_ATTRIB_ARRAY); capU32(index); real_glEnableVertexAttribArray(index); }
+void APIENTRY cap_glDisableVertexAttribArray (GLuint index) { capOp(CAP_DISABLE_VERTEX_ATTRIB_ARRAY); capU32(index); real_glDisableVertexAttribArray(index); }
+void APIENTRY cap_glVertexAttribDivisor (GLuint index, GLuint divisor) { capOp(CAP_VERTEX_ATTRIB_DIVISOR); capU32(index); capU32(divisor); real_glVertexAttribDivisor(index, divisor); }
+void APIENTRY cap_glDrawArrays (GLenum mode, GLint first, GLsizei count) { capOp(CAP_DRAW_ARRAYS); capU32(mode); capU32(first); capU32(count); real_glDrawArrays(mode, first, count); }
+void APIENTRY cap_glDrawArraysInstanced (GLenum mode, GLint first, GLsizei count, GLsizei instances) { capOp(CAP_DRAW_ARRAYS_INSTANCED); capU32(mode); capU32(first); capU32(count); capU32(instances); real_glDrawArraysInstanced(mode, first, count, instances); }
+
+void APIENTRY cap_glGenTextures (GLsizei n, GLuint *textures) { real_glGenTextures(n, textures); capGenNames(CAP_GEN_TEXTURES, n, textures); }
+void APIENTRY cap_glBindTexture (GLenum target, GLuint texture) { capOp(CAP_BIND_TEXTURE); capU32(target); capU32(texture); real_glBindTexture(target, texture); }
+void APIENTRY cap_glActiveTexture (GLenum texture) { capOp(CAP_ACTIVE_TEXTURE); capU32(texture); real_glActiveTexture(texture); }
+void APIENTRY cap_glTexParameteri (GLenum target, GLenum pname, GLint param) { capOp(CAP_TEX_PARAMETERI); capU32(target); capU32(pname); capU32(param); real_glTexParameteri(target, pname, param); }
+
+void APIENTRY cap_glTexImage2D (GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void *pixels)
+{
+	capOp(CAP_TEX_IMAGE_2D); capU32(target); capU32(level); capU32(internalformat); capU32(width); capU32(height); capU32(border); capU32(format); capU32(type);
+	capBytes(pixels, capImageSize(width, height, format, type));
+	real_glTexImage2D(target, level, internalformat, width, height, border, format, type, pixels);
+}
+
+void APIENTRY cap_glTexSubImage2D (GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const void *pixels)
+{
+	capOp(CAP_TEX_SUB_IMAGE_2D); capU32(target); capU32(level); capU32(xoffset); capU32(yoffset); capU32(width); capU32(height); capU32(format); capU32(type);
+	capBytes(pixels, capImageSize(width, height, format, type));
+	real_glTexSubImage2D(target, level, xoffset, yoffset, width, height, format, type, pixels);
+}
+
+void APIENTRY cap_glGenFramebuffers (GLsizei n, GLuint *framebuffers) { real_glGenFramebuffers(n, framebuffers); capGenNames(CAP_GEN_FRAMEBUFFERS, n, framebuffers); }
+void APIENTRY cap_glBindFramebuffer (GLenum target, GLuint framebuffer) { capOp(CAP_BIND_FRAMEBUFFER); capU32(target); capU32(framebuffer); real_glBindFramebuffer(target, framebuffer); }
+void APIENTRY cap_glFramebufferTexture2D (GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level) { capOp(CAP_FRAMEBUFFER_TEXTURE_2D); capU32(target); capU32(attachment); capU32(textarget); capU32(texture); capU32(level); real_glFramebufferTexture2D(target, attachment, textarget, texture, level); }
+void APIENTRY cap_glGenRenderbuffers (GLsizei n, GLuint *renderbuffers) { real_glGenRenderbuffers(n, renderbuffers); capGenNames(CAP_GEN_RENDERBUFFERS, n, renderbuffers); }
+void APIENTRY cap_glBindRenderbuffer (GLenum target, GLuint renderbuffer) { capOp(CAP_BIND_RENDERBUFFER); capU32(target); capU32(renderbuffer); real_glBindRenderbuffer(target, renderbuffer); }
+void APIENTRY cap_glRenderbufferStorage (GLenum target, GLenum internalformat, GLsizei width, GLsizei height) { capOp(CAP_RENDERBUFFER_STORAGE); capU32(target); capU32(internalformat); capU32(width); capU32(height); real_glRenderbufferStorage(target, internalformat, width, height); }
+void APIENTRY cap_glFramebufferRenderbuffer (GLenum target, GLenum attachment, GLenum rbtarget, GLuint renderbuffer) { capOp(CAP_FRAMEBUFFER_RENDERBUFFER); capU32(target); capU32(attachment); capU32(rbtarget); capU32(renderbuffer); real_glFramebufferRenderbuffer(target, attachment, rbtarget, renderbuffer); }
+
+void APIENTRY cap_glBlitFramebuffer (GLint sx0, GLint sy0, GLint sx1, GLint sy1, GLint dx0, GLint dy0, GLint dx1, GLint dy1, GLbitfield mask, GLenum filter)
+{
+	capOp(CAP_BLIT_FRAMEBUFFER); capU32(sx0); capU32(sy0); capU32(sx1); capU32(sy1); capU32(dx0); capU32(dy0); capU32(dx1); capU32(dy1); capU32(mask); capU32(filter);
+	real_glBlitFramebuffer(sx0, sy0, sx1, sy1, dx0, dy0, dx1, dy1, mask, filter);
+}
+
+void APIENTRY cap_glTransformFeedbackVaryings (GLuint program, GLsizei count, const GLchar *const *varyings, GLenum bufferMode)
+{
+	capOp(CAP_TRANSFORM_FEEDBACK_VARYINGS); capU32(program); capU32(count);
+	for (int i=0; i < count; i++)
+		capBytes(varyings[i], strlen(varyings[i]));
+	capU32(bufferMode);
+	real_glTransformFeedbackVaryings(program, count, varyings, bufferMode);
+}
+
+void APIENTRY cap_glBindBufferBase (GLenum target, GLuint index, GLuint buffer) { capOp(CAP_BIND_BUFFER_BASE); capU32(target); capU32(index); capU32(buffer); real_glBindBufferBase(target, index, buffer); }
+void APIENTRY cap_glBeginTransformFeedback (GLenum mode) { capOp(CAP_BEGIN_TRANSFORM_FEEDBACK); capU32(mode); real_glBeginTransformFeedback(mode); }
+void APIENTRY cap_glEndTransformFeedback () { capOp(CAP_END_TRANSFORM_FEEDBACK); real_glEndTransformFeedback(); }
+void APIENTRY cap_glGenTransformFeedbacks (GLsizei n, GLuint *ids) { real_glGenTransformFeedbacks(n, ids); capGenNames(CAP_GEN_TRANSFORM_FEEDBACKS, n, ids); }
+void APIENTRY cap_glBindTransformFeedback (GLenum target, GLuint id) { capOp(CAP_BIND_TRANSFORM_FEEDBACK); capU32(target); capU32(id); real_glBindTransformFeedback(target, id); }
+void APIENTRY cap_glDrawTransformFeedback (GLenum mode, GLuint id) { capOp(CAP_DRAW_TRANSFORM_FEEDBACK); capU32(mode); capU32(id); real_glDrawTransformFeedback(mode, id); }
+
+// Point every wrapped entry point at its recorder, or back at the driver
+#define CAP_HOOK(fn) if (installing) { real_##fn = glad_##fn; glad_##fn = cap_##fn; } else glad_##fn = real_##fn;
+void captureHooks (int installing)
+{
+	CAP_HOOK(glClear) CAP_HOOK(glClearColor) CAP_HOOK(glClearDepth) CAP_HOOK(glEnable) CAP_HOOK(glDisable)
+	CAP_HOOK(glDepthFunc) CAP_HOOK(glBlendFunc) CAP_HOOK(glViewport) CAP_HOOK(glPolygonMode) CAP_HOOK(glPixelStorei)
+	CAP_HOOK(glCreateShader) CAP_HOOK(glShaderSource) CAP_HOOK(glCompileShader) CAP_HOOK(glDeleteShader)
+	CAP_HOOK(glCreateProgram) CAP_HOOK(glAttachShader) CAP_HOOK(glLinkProgram) CAP_HOOK(glUseProgram)
+	CAP_HOOK(glGetUniformLocation) CAP_HOOK(glUniformMatrix4fv) CAP_HOOK(glUniform1i) CAP_HOOK(glUniform1f)
+	CAP_HOOK(glUniform2f) CAP_HOOK(glUniform4f) CAP_HOOK(glUniform4fv)
+	CAP_HOOK(glGenVertexArrays) CAP_HOOK(glBindVertexArray) CAP_HOOK(glGenBuffers) CAP_HOOK(glBindBuffer)
+	CAP_HOOK(glBufferData) CAP_HOOK(glBufferSubData) CAP_HOOK(glVertexAttribPointer)
+	CAP_HOOK(glEnableVertexAttribArray) CAP_HOOK(glDisableVertexAttribArray) CAP_HOOK(glVertexAttribDivisor)
+	CAP_HOOK(glDrawArrays) CAP_HOOK(glDrawArraysInstanced)
+	CAP_HOOK(glGenTextures) CAP_HOOK(glBindTexture) CAP_HOOK(glActiveTexture) CAP_HOOK(glTexParameteri)
+	CAP_HOOK(glTexImage2D) CAP_HOOK(glTexSubImage2D)
+	CAP_HOOK(glGenFramebuffers) CAP_HOOK(glBindFramebuffer) CAP_HOOK(glFramebufferTexture2D)
+	CAP_HOOK(glGenRenderbuffers) CAP_HOOK(glBindRenderbuffer) CAP_HOOK(glRenderbufferStorage)
+	CAP_HOOK(glFramebufferRenderbuffer) CAP_HOOK(glBlitFramebuffer)
+	CAP_HOOK(glTransformFeedbackVaryings) CAP_HOOK(glBindBufferBase)
+	CAP_HOOK(glBeginTransformFeedback) CAP_HOOK(glEndTransformFeedback)
+	CAP_HOOK(glGenTransformFeedbacks) CAP_HOOK(glBindTransformFeedback) CAP_HOOK(glDrawTransformFeedback)
+}
+#undef CAP_HOOK
+
+void captureStart (const char *path, int frames, int width, int height)
+{
+	cap_file = fopen(path, "wb");
+	if (!cap_file) {
+		fprintf(stderr, "Error: could not open %s for capture\n", path);
+		return;
+	}
+	fwrite(CAP_MAGIC, 1, 8, cap_file);
+	capU32(CAP_VERSION);
+	capU32(width);
+	capU32(height);
+	cap_frames_left = frames;
+	captureHooks(1);
+	printf("capturing %d frames to %s\n", frames, path);
+}
+
+/* Called at the top of every frame; closes the stream once N frames are in */
+void captureFrame ()
+{
+	if (!cap_file)
+		return;
+	if (cap_frames_left-- == 0) {
+		capOp(CAP_END);
+		fclose(cap_file);
+		cap_file = NULL;
+		captureHooks(0);
+		printf("capture finished\n");
+		return;
+	}
+	capOp(CAP_FRAME);
+}
+
+
+/**************************
+ * GL debug output        *
+ **************************/
+
+/* --gl-debug FILE asks for a debug context and installs a KHR_debug callback.
+   Driver messages about performance, undefined behaviour, errors and
+   deprecated use are written to FILE ("-" for stderr) as one JSON object
+   per line. The callback is synchronous, so it runs inside the offending
+   call and can name the object being drawn. Each message id is logged at
+   most debug_burst times a second; the rest are counted and reported */
+FILE *debug_file = NULL;
+int debug_burst = 5;
+map<GLuint, int> debug_seen, debug_suppressed;
+
+const char* debugSourceName (GLenum source)
+{
+	switch (source) {
+		case GL_DEBUG_SOURCE_API: return "api";
+		case GL_DEBUG_SOURCE_WINDOW_SYSTEM: return "window_system";
+		case GL_DEBUG_SOURCE_SHADER_COMPILER: return "shader_compiler";
+		case GL_DEBUG_SOURCE_THIRD_PARTY: return "third_party";
+		case GL_DEBUG_SOURCE_APPLICATION: return "application";
+		default: return "other";
+	}
+}
+
+const char* debugTypeName (GLenum type)
+{
+	switch (type) {
+		case GL_DEBUG_TYPE_ERROR: return "error";
+		case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "deprecated";
+		case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR: return "undefined_behavior";
+		case GL_DEBUG_TYPE_PORTABILITY: return "portability";
+		case GL_DEBUG_TYPE_PERFORMANCE: return "performance";
+		default: return "other";
+	}
+}
+
+const char* debugSeverityName (GLenum severity)
+{
+	switch (severity) {
+		case GL_DEBUG_SEVERITY_HIGH: return "high";
+		case GL_DEBUG_SEVERITY_MEDIUM: return "medium";
+		case GL_DEBUG_SEVERITY_LOW: return "low";
+		default: return "notification";
+	}
+}
+
+/* Write s as a JSON string literal */
+void debugJSONString (const char *s, int length)
+{
+	fputc('"', debug_file);
+	for (int i=0; s && (length < 0 ? s[i] != 0 : i < length); i++) {
+		unsigned char c = s[i];
+		if (c == '"' || c == '\\')
+			fprintf(debug_file, "\\%c", c);
+		else if (c == '\n')
+			fputs("\\n", debug_file);
+		else if (c < 0x20)
+			fprintf(debug_file, "\\u%04x", c);
+		else
+			fputc(c, debug_file);
+	}
+	fputc('"', debug_file);
+}
+
+void APIENTRY debugCallback (GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar *message, const void *userParam)
+{
+	if (debug_seen[id]++ >= debug_burst) {
+		debug_suppressed[id]++;
+		return;
+	}
+	fprintf(debug_file, "{\"time\":%.4f,\"frame\":%ld,\"source\":\"%s\",\"type\":\"%s\",\"severity\":\"%s\",\"id\":%u,\"object\":",
+			glfwGetTime(), frames_drawn, debugSourceName(source), debugTypeName(type), debugSeverityName(severity), id);
+	debugJSONString(gl_debug_object ? gl_debug_object : "", -1);
+	fputs(",\"message\":", debug_file);
+	debugJSONString(message, length);
+	fputs("}\n", debug_file);
+}
+
+/* Log which run of the mesh buffer a named object has from now on */
+void debugMeshName (const VAO* vao)
+{
+	if (!debug_file || vao->MeshFirst < 0)
+		return;
+	fprintf(debug_file, "{\"time\":%.4f,\"frame\":%ld,\"mesh\":", glfwGetTime(), frames_drawn);
+	debugJSONString(vao->Name, -1);
+	fprintf(debug_file, ",\"first\":%d,\"count\":%d}\n", vao->MeshFirst, vao->NumVertices);
+}
+
+/* Called once a second: report what the rate limit dropped and open a new window */
+void debugFlush ()
+{
+	if (!debug_file)
+		return;
+	for (map<GLuint, int>::iterator it = debug_suppressed.begin(); it != debug_suppressed.end(); ++it)
+		fprintf(debug_file, "{\"time\":%.4f,\"frame\":%ld,\"id\":%u,\"suppressed\":%d}\n", glfwGetTime(), frames_drawn, it->first, it->second);
+	debug_seen.clear();
+	debug_suppressed.clear();
+	fflush(debug_file);
+}
+
+void debugInstall (const char *path)
+{
+	if (!GLAD_GL_KHR_debug) {
+		fprintf(stderr, "Error: GL_KHR_debug is not available, --gl-debug ignored\n");
+		return;
+	}
+	debug_file = strcmp(path, "-") ? fopen(path, "w") : stderr;
+	if (!debug_file) {
+		fprintf(stderr, "Error: could not open %s\n", path);
+		return;
+	}
+	glEnable(GL_DEBUG_OUTPUT);
+	glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+	glDebugMessageCallback(debugCallback, NULL);
+	// Only what points at real problems or wasted work, not the chatter
+	glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, GL_FALSE);
+	GLenum wanted[] = { GL_DEBUG_TYPE_ERROR, GL_DEBUG_TYPE_PERFORMANCE, GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR, GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR };
+	for (int i=0; i < 4; i++)
+		glDebugMessageControl(GL_DONT_CARE, wanted[i], GL_DONT_CARE, 0, NULL, GL_TRUE);
+	glDebugMessageControl(GL_DEBUG_SOURCE_SHADER_COMPILER, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, GL_TRUE);
+	gl_debug_labels = 1;
+	printf("GL debug output logged to %s\n", path);
+}
+
+
+/**************************
+ * Static layer cache     *
+ **************************/
+
+/* On the GL backend the static part of the scene under the moving objects
+   (drawStatic) is drawn once into layer_tex and every later frame starts
+   with a single blit of it. It is redrawn when the camera box from
+   reshapeWindow, the render target size or the level changes, and after
+   createMap */
+GLuint layer_fbo = 0, layer_tex = 0;
+int layer_w = 0, layer_h = 0, layer_level = -1;
+int layer_enabled = 1, layer_valid = 0, layer_drawing = 0;
+float layer_box[4];
+
+void invalidateStaticLayer ()
+{
+	layer_valid = 0;
+}
+
+/* The framebuffer draw() is rendering into, and its size */
+GLuint sceneTarget (int *w, int *h)
+{
+	if (render_scale_lod[quality] >= 1) {
+		*w = fb_w;
+		*h = fb_h;
+		return 0;
+	}
+	*w = scene_w;
+	*h = scene_h;
+	return scene_fbo;
+}
+
+void blitStaticLayer (GLuint target, int w, int h)
+{
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, layer_fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+	glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, target);
+}
+
+/* Put the cached layer on screen if it is still good, else return 0 */
+int staticLayerComposite ()
+{
+	if (!layer_enabled || backend != &gl_backend)
+		return 0;
+	int w, h;
+	GLuint target = sceneTarget(&w, &h);
+	float box[4] = {x_1, x_2, y_1, y_2};
+	if (w != layer_w || h != layer_h || level != layer_level || memcmp(box, layer_box, sizeof(box)))
+		layer_valid = 0;
+	if (!layer_valid)
+		return 0;
+	blitStaticLayer(target, w, h);
+	return 1;
+}
+
+/* Redirect the following draws into the layer */
+void staticLayerBegin ()
+{
+	if (!layer_enabled || backend != &gl_backend)
+		return;
+	int w, h;
+	sceneTarget(&w, &h);
+	if (layer_fbo == 0) {
+		glGenFramebuffers(1, &layer_fbo);
+		glGenTextures(1, &layer_tex);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, layer_fbo);
+	if (w != layer_w || h != layer_h) {
+		layer_w = w;
+		layer_h = h;
+		glBindTexture(GL_TEXTURE_2D, layer_tex);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, layer_tex, 0);
+	}
+	glViewport(0, 0, w, h);
+	glClear(GL_COLOR_BUFFER_BIT);
+	layer_drawing = 1;
+}
+
+/* Finish the layer and put it under the rest of the frame */
+void staticLayerEnd ()
+{
+	if (!layer_drawing)
+		return;
+	layer_drawing = 0;
+	layer_valid = 1;
+	layer_level = level;
+	layer_box[0] = x_1;
+	layer_box[1] = x_2;
+	layer_box[2] = y_1;
+	layer_box[3] = y_2;
+
+	int w, h;
+	GLuint target = sceneTarget(&w, &h);
+	glViewport(0, 0, w, h);
+	blitStaticLayer(target, w, h);
+}
+
+
+/**************************
+ * Post-processing        *
+ **************************/
+
+/* Optional passes run on the GL backend after draw(): the key, exit and
+   explosion pellets are drawn again into a half resolution glow target,
+   optionally downsampled to quarter resolution, blurred with a separable
+   gaussian and added back over the scene together with a vignette.
+   GPU time comes from the post pass of the pass timer, and the chain steps
+   down to quarter resolution, then to vignette only, when it exceeds
+   post_budget */
+
+#define POST_HALF 0
+#define POST_QUARTER 1
+#define POST_VIGNETTE 2
+const char *post_level_name[3] = {"half res bloom", "quarter res bloom", "vignette only"};
+
+int post_enabled = 0;	// --post
+double post_budget = 1.0;	// ms of GPU time, --post-budget
+int post_level = POST_HALF;
+int post_w = 0, post_h = 0, post_div = 0;
+GLuint post_fbo[3], post_tex[3], post_vao = 0;
+GLuint blur_program = 0, composite_program = 0;
+GLint blur_step_id, composite_strength_id, composite_vignette_id;
+float glow_strength = 1.5, vignette_strength = 0.6;
+
+// Glow objects seen this frame with the matrix they were drawn with
+vector< pair<VAO*, Affine2> > post_glow;
+
+int post_skipped = 0;	// frames dropped by the governor since the last report
+
+void postInit ()
+{
+	if (backend != &gl_backend) {
+		fprintf(stderr, "Post-processing needs the gl renderer, ignoring --post\n");
+		post_enabled = 0;
+		return;
+	}
+	blur_program = LoadShaders("Sample_GL_post.vert", "Sample_GL_blur.frag");
+	glUseProgram(blur_program);
+	glUniform1i(glGetUniformLocation(blur_program, "source"), 0);
+	blur_step_id = glGetUniformLocation(blur_program, "texelStep");
+
+	composite_program = LoadShaders("Sample_GL_post.vert", "Sample_GL_composite.frag");
+	glUseProgram(composite_program);
+	glUniform1i(glGetUniformLocation(composite_program, "glow"), 0);
+	composite_strength_id = glGetUniformLocation(composite_program, "glowStrength");
+	composite_vignette_id = glGetUniformLocation(composite_program, "vignette");
+	glUseProgram(programID);
+
+	glGenVertexArrays(1, &post_vao);
+	glGenFramebuffers(3, post_fbo);
+	glGenTextures(3, post_tex);
+}
+
+void postGlow (VAO* vao)
+{
+	if (post_enabled && backend == &gl_backend)
+		post_glow.push_back(make_pair(vao, gl_mvp));
+}
+
+void postTarget (int i, int w, int h)
+{
+	glBindTexture(GL_TEXTURE_2D, post_tex[i]);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindFramebuffer(GL_FRAMEBUFFER, post_fbo[i]);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, post_tex[i], 0);
+}
+
+/* (Re)allocate the glow target at half and the blur pair at 1/div of the scene */
+void postResize (int w, int h, int div)
+{
+	if (w == post_w && h == post_h && div == post_div)
+		return;
+	post_w = w;
+	post_h = h;
+	post_div = div;
+	postTarget(0, max(1, w/2), max(1, h/2));
+	postTarget(1, max(1, w/div), max(1, h/div));
+	postTarget(2, max(1, w/div), max(1, h/div));
+}
+
+void postBlur (int src, int dst, float dx, float dy)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, post_fbo[dst]);
+	glBindTexture(GL_TEXTURE_2D, post_tex[src]);
+	glUniform2f(blur_step_id, dx, dy);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+void postProcess ()
+{
+	vector< pair<VAO*, Affine2> > glow;
+	glow.swap(post_glow);
+	if (!post_enabled)
+		return;
+	if (post_skip) {
+		post_skipped++;
+		return;
+	}
+
+	gpuPass(PASS_POST);
+	int w, h;
+	GLuint target = sceneTarget(&w, &h);
+	glDisable(GL_DEPTH_TEST);
+	int bloom = post_level != POST_VIGNETTE && !glow.empty();
+	int blurred = 0;
+	if (bloom) {
+		int div = post_level == POST_QUARTER ? 4 : 2;
+		postResize(w, h, div);
+
+		// Glow sources at half resolution
+		glBindFramebuffer(GL_FRAMEBUFFER, post_fbo[0]);
+		glViewport(0, 0, max(1, w/2), max(1, h/2));
+		glClear(GL_COLOR_BUFFER_BIT);
+		glUseProgram(programID);
+		viewsClip(1);
+		for (size_t i=0; i < glow.size(); i++) {
+			glBackendSetMVP(glow[i].second);
+			glDraw3DObject(glow[i].first);
+		}
+		viewsClip(0);
+		gl_debug_object = "post";
+
+		int bw = max(1, w/div), bh = max(1, h/div), src = 0;
+		if (div == 4) {
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, post_fbo[0]);
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, post_fbo[1]);
+			glBlitFramebuffer(0, 0, max(1, w/2), max(1, h/2), 0, 0, bw, bh, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+			src = 1;
+		}
+
+		// Separable blur, horizontal then vertical
+		int tmp = src == 1 ? 2 : 1, dst = src == 1 ? 1 : 2;
+		glViewport(0, 0, bw, bh);
+		bindVertexArray(post_vao);
+		glUseProgram(blur_program);
+		postBlur(src, tmp, 1.0f/bw, 0);
+		postBlur(tmp, dst, 0, 1.0f/bh);
+		blurred = dst;
+	}
+
+	// Composite: scene * vignette + glow
+	gl_debug_object = "post";
+	glBindFramebuffer(GL_FRAMEBUFFER, target);
+	glViewport(0, 0, w, h);
+	bindVertexArray(post_vao);
+	glUseProgram(composite_program);
+	glBindTexture(GL_TEXTURE_2D, post_tex[blurred]);
+	glUniform1f(composite_strength_id, bloom ? glow_strength : 0);
+	glUniform1f(composite_vignette_id, vignette_strength);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_SRC_ALPHA);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glDisable(GL_BLEND);
+
+	glEnable(GL_DEPTH_TEST);
+	glUseProgram(programID);
+}
+
+/* Once a second: hold the chain inside its budget and report what it costs */
+void postReport ()
+{
+	double avg = gpuPassTime(PASS_POST);
+	if (!post_enabled || avg < 0) {
+		post_skipped = 0;
+		return;
+	}
+	if (show_stats)
+		printf("post: %.3f ms GPU per frame, %s, %d frames skipped by the governor\n", avg, post_level_name[post_level], post_skipped);
+	if (avg > post_budget && post_level < POST_VIGNETTE) {
+		post_level++;
+		printf("post: over %.2f ms budget, down to %s\n", post_budget, post_level_name[post_level]);
+	}
+	else if (avg < 0.4*post_budget && post_level > POST_HALF) {
+		post_level--;
+		printf("post: up to %s\n", post_level_name[post_level]);
+	}
+	post_skipped = 0;
+}
+
+
+float camera_rotation_angle = 90;
+double v_x,v_y,a_x = 0.015 ,a_y = 0.03,v = 1;
+double x_proj,y_proj,x_p,y_p,x_p1,x_p2,x_p4,x_p5,x_p6,x_p8,y_p2,y_p3,y_p4,y_p6,y_p7,y_p8;
+
+double x_curm;
+double y_curm;
+
+float rectangle_rotation;
+
+
+/**************************
+ * Overdraw heatmap       *
+ **************************/
+
+/* --overdraw (GL backend): every object is drawn with a fragment shader
+   that outputs 1, added up in a half float target, and the counts are then
+   shown through a colour ramp. The layer cache, sprites, trail, particles,
+   lighting, post-processing and minimap are off in this mode so every
+   pixel reflects plain object draws */
+GLuint overdraw_fbo = 0, overdraw_tex = 0, overdraw_vao = 0, overdraw_program = 0;
+int overdraw_w = 0, overdraw_h = 0;
+
+void overdrawInit ()
+{
+	overdraw_program = LoadShaders("Sample_GL_post.vert", "Sample_GL_overdraw_ramp.frag");
+	glUseProgram(overdraw_program);
+	glUniform1i(glGetUniformLocation(overdraw_program, "counts"), 0);
+	glUseProgram(programID);
+	glGenVertexArrays(1, &overdraw_vao);
+	glGenFramebuffers(1, &overdraw_fbo);
+	glGenTextures(1, &overdraw_tex);
+	printf("overdraw: black 0, blue 1, cyan 2, green 3, yellow 4, red 5, white 6+ draws per pixel\n");
+}
+
+/* Send the following draws into the count target */
+void overdrawBegin ()
+{
+	if (!overdraw_enabled)
+		return;
+	int w, h;
+	sceneTarget(&w, &h);
+	glBindFramebuffer(GL_FRAMEBUFFER, overdraw_fbo);
+	if (w != overdraw_w || h != overdraw_h) {
+		overdraw_w = w;
+		overdraw_h = h;
+		glBindTexture(GL_TEXTURE_2D, overdraw_tex);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, w, h, 0, GL_RED, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, overdraw_tex, 0);
+	}
+	glViewport(0, 0, w, h);
+	glClearColor(0, 0, 0, 0);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glClearColor(0.2f, 0.2f, 0.2f, 0.2f);
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+}
+
+/* Replace the frame with the counts mapped through the ramp */
+void overdrawResolve ()
+{
+	if (!overdraw_enabled)
+		return;
+	glDisable(GL_BLEND);
+	int w, h;
+	GLuint target = sceneTarget(&w, &h);
+	gl_debug_object = "overdraw";
+	glBindFramebuffer(GL_FRAMEBUFFER, target);
+	glViewport(0, 0, w, h);
+	glUseProgram(overdraw_program);
+	bindVertexArray(overdraw_vao);
+	glBindTexture(GL_TEXTURE_2D, overdraw_tex);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glEnable(GL_DEPTH_TEST);
+	glUseProgram(programID);
+}
+
+
+/**************************
+ * 2D lighting            *
+ **************************/
+
+/* Point lights on the ball, key and exit with obstacle shadows (--lights).
+   The level's tiles are kept in a small one byte per tile texture; the
+   lightmap is rendered at 1/light_div of the scene by marching a fixed
+   number of samples from each texel to each light through that texture,
+   then stretched over the scene with a multiply blend */
+
+#define MAX_LIGHTS 8
+#define LIGHT_GRID_W 128	// covers the 96x54 world
+#define LIGHT_GRID_H 64
+
+int light_enabled = 0;
+int light_div = 8;	// --lightmap-div
+GLuint light_program = 0, light_copy_program = 0;
+GLuint light_fbo = 0, light_tex = 0, light_tiles = 0, light_vao = 0;
+int light_w = 0, light_h = 0;
+GLint light_view_id, light_hud_id, light_ambient_id, light_count_id;
+GLint light_pos_id[MAX_LIGHTS], light_color_id[MAX_LIGHTS];
+
+void lightInit ()
+{
+	if (backend != &gl_backend) {
+		fprintf(stderr, "Lighting needs the gl renderer, ignoring --lights\n");
+		light_enabled = 0;
+		return;
+	}
+	light_program = LoadShaders("Sample_GL_post.vert", "Sample_GL_lightmap.frag");
+	glUseProgram(light_program);
+	glUniform1i(glGetUniformLocation(light_program, "tiles"), 0);
+	light_view_id = glGetUniformLocation(light_program, "view");
+	light_hud_id = glGetUniformLocation(light_program, "hudLine");
+	light_ambient_id = glGetUniformLocation(light_program, "ambient");
+	light_count_id = glGetUniformLocation(light_program, "lightCount");
+	for (int i=0; i < MAX_LIGHTS; i++) {
+		char name[32];
+		sprintf(name, "lights[%d]", i);
+		light_pos_id[i] = glGetUniformLocation(light_program, name);
+		sprintf(name, "lightColors[%d]", i);
+		light_color_id[i] = glGetUniformLocation(light_program, name);
+	}
+
+	light_copy_program = LoadShaders("Sample_GL_post.vert", "Sample_GL_texture.frag");
+	glUseProgram(light_copy_program);
+	glUniform1i(glGetUniformLocation(light_copy_program, "source"), 0);
+	glUseProgram(programID);
+
+	glGenVertexArrays(1, &light_vao);
+	glGenFramebuffers(1, &light_fbo);
+	glGenTextures(1, &light_tex);
+	glGenTextures(1, &light_tiles);
+}
+
+/* Rebuild the occluder texture from the obstacles createMap() just placed */
+void lightTiles ()
+{
+	if (!light_enabled)
+		return;
+	vector<unsigned char> grid(LIGHT_GRID_W*LIGHT_GRID_H, 0);
+	for (size_t i=0; i < obst.size(); i++) {
+		int x = floor(obst[i].x), y = floor(obst[i].y);
+		if (x >= 0 && x < LIGHT_GRID_W && y >= 0 && y < LIGHT_GRID_H)
+			grid[y*LIGHT_GRID_W + x] = 255;
+	}
+	glBindTexture(GL_TEXTURE_2D, light_tiles);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, LIGHT_GRID_W, LIGHT_GRID_H, 0, GL_RED, GL_UNSIGNED_BYTE, &grid[0]);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+void lightProcess ()
+{
+	if (!light_enabled)
+		return;
+	gpuPass(PASS_LIGHTING);
+
+	// Ball, key until it is picked up, and exit, in world units
+	float lights[MAX_LIGHTS][6];
+	int count = 0;
+	float ball_x = flag == 1 ? x_proj+5 : 5, ball_y = flag == 1 ? y_proj+5 : 5;
+	float ball[6] = {ball_x, ball_y, 14, 1, 0.9, 0.7};
+	memcpy(lights[count++], ball, sizeof(ball));
+	if (pass == 0 && k_pos_x > 0) {
+		float key_light[6] = {(float)k_pos_x, (float)k_pos_y, 10, 1, 0.3, 1};
+		memcpy(lights[count++], key_light, sizeof(key_light));
+	}
+	if (e_pos_x > 0) {
+		float exit_light[6] = {(float)e_pos_x, (float)e_pos_y, 12, 0.3, 1, 1};
+		memcpy(lights[count++], exit_light, sizeof(exit_light));
+	}
+
+	int w, h;
+	GLuint target = sceneTarget(&w, &h);
+	int lw = max(1, w/light_div), lh = max(1, h/light_div);
+	if (lw != light_w || lh != light_h) {
+		light_w = lw;
+		light_h = lh;
+		glBindTexture(GL_TEXTURE_2D, light_tex);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, lw, lh, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindFramebuffer(GL_FRAMEBUFFER, light_fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, light_tex, 0);
+	}
+
+	// Lightmap
+	gl_debug_object = "lightmap";
+	glDisable(GL_DEPTH_TEST);
+	bindVertexArray(light_vao);
+	glBindFramebuffer(GL_FRAMEBUFFER, light_fbo);
+	glViewport(0, 0, lw, lh);
+	glUseProgram(light_program);
+	glBindTexture(GL_TEXTURE_2D, light_tiles);
+	glUniform4f(light_view_id, x_1, y_1, x_2-x_1, y_2-y_1);
+	glUniform1f(light_hud_id, 45);
+	glUniform4f(light_ambient_id, 0.35, 0.35, 0.4, 0);
+	glUniform1i(light_count_id, count);
+	for (int i=0; i < count; i++) {
+		glUniform4f(light_pos_id[i], lights[i][0], lights[i][1], lights[i][2], 0);
+		glUniform4f(light_color_id[i], lights[i][3], lights[i][4], lights[i][5], 0);
+	}
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+	// Stretch it over the scene: scene * light
+	glBindFramebuffer(GL_FRAMEBUFFER, target);
+	glViewport(0, 0, w, h);
+	glUseProgram(light_copy_program);
+	glBindTexture(GL_TEXTURE_2D, light_tex);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ZERO, GL_SRC_COLOR);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glDisable(GL_BLEND);
+
+	glEnable(GL_DEPTH_TEST);
+	glUseProgram(programID);
+}
+
+
+/**************************
+ * Projectile trail       *
+ **************************/
+
+/* Fading trail behind the ball in flight (GL backend, --no-trail to drop it).
+   The last TRAIL_LENGTH positions live in a ring in one vertex buffer that
+   is allocated once; each frame writes a single slot (two vertices) with
+   glBufferSubData and the whole ring is drawn as one triangle strip. Slot 0
+   is written twice, the second time past the end of the ring, so the strip
+   also joins the last slot to the first when the ring wraps. The shader
+   works out each slot's age from the head index */
+
+#define TRAIL_LENGTH 64	// keep in step with Sample_GL_trail.vert
+
+int trail_enabled = 1;
+GLuint trail_program = 0, trail_vao = 0, trail_vbo = 0;
+GLint trail_mvp_id, trail_head_id, trail_count_id, trail_color_id;
+int trail_head = 0, trail_count = 0;
+float trail_last_x, trail_last_y;
+
+void trailInit ()
+{
+	if (!trail_enabled || backend != &gl_backend)
+		return;
+	trail_program = LoadShaders("Sample_GL_trail.vert", "Sample_GL_trail.frag", split_view ? "#define VIEWS\n" : NULL);
+	viewRegister(trail_program);
+	trail_mvp_id = glGetUniformLocation(trail_program, "MVP");
+	trail_head_id = glGetUniformLocation(trail_program, "head");
+	trail_count_id = glGetUniformLocation(trail_program, "count");
+	trail_color_id = glGetUniformLocation(trail_program, "trailColor");
+
+	glGenVertexArrays(1, &trail_vao);
+	glGenBuffers(1, &trail_vbo);
+	bindVertexArray(trail_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, trail_vbo);
+	glBufferData(GL_ARRAY_BUFFER, (TRAIL_LENGTH + 1)*8*sizeof(GLfloat), NULL, GL_DYNAMIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4*sizeof(GLfloat), (void*)0);
+	if (gl_debug_labels) {
+		glObjectLabel(GL_VERTEX_ARRAY, trail_vao, -1, "trail");
+		glObjectLabel(GL_BUFFER, trail_vbo, -1, "trail");
+	}
+}
+
+/* A new shot starts a new trail */
+void trailReset ()
+{
+	trail_count = 0;
+}
+
+/* Append the ball centre (x, y) in world units */
+void trailPush (float x, float y)
+{
+	if (!trail_vbo)
+		return;
+	float dx = 1, dy = 0;
+	if (trail_count > 0) {
+		dx = x - trail_last_x;
+		dy = y - trail_last_y;
+		float len = sqrt(dx*dx + dy*dy);
+		if (len < 1e-4)
+			return;
+		dx /= len;
+		dy /= len;
+	}
+	trail_last_x = x;
+	trail_last_y = y;
+
+	// Both edges of the strip at this point, offset across the direction of travel
+	const float half_width = 0.35;
+	GLfloat slot[8] = {
+		x, y, -dy*half_width, dx*half_width,
+		x, y, dy*half_width, -dx*half_width
+	};
+	trail_head = (trail_head + 1) % TRAIL_LENGTH;
+	trail_count = min(trail_count + 1, TRAIL_LENGTH);
+	glBindBuffer(GL_ARRAY_BUFFER, trail_vbo);
+	glBufferSubData(GL_ARRAY_BUFFER, trail_head*sizeof(slot), sizeof(slot), slot);
+	if (trail_head == 0)
+		glBufferSubData(GL_ARRAY_BUFFER, TRAIL_LENGTH*sizeof(slot), sizeof(slot), slot);
+}
+
+void trailDraw (const glm::mat4 &VP)
+{
+	if (!trail_vbo || trail_count < 2)
+		return;
+	gl_debug_object = "trail";
+	glUseProgram(trail_program);
+	glUniformMatrix4fv(trail_mvp_id, 1, GL_FALSE, &VP[0][0]);
+	glUniform1i(trail_head_id, trail_head);
+	glUniform1i(trail_count_id, trail_count);
+	glUniform4f(trail_color_id, 1, 0.8, 0.3, 0.7);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	bindVertexArray(trail_vao);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	viewDrawArrays(GL_TRIANGLE_STRIP, 0, 2*(TRAIL_LENGTH + 1));
+	glDisable(GL_BLEND);
+	glUseProgram(programID);
+}
+
+/**************************
+ * GPU particles          *
+ **************************/
+
+/* Explosions on the GL backend (--particles N sets the pool, 0 falls back
+   to the eight CPU pellets). Particles live in two vertex buffers; every
+   frame a vertex shader reads one, integrates it and writes the other
+   through transform feedback with rasterization off, then the result is
+   drawn as points. Emitters only pass a position and a range of ring slots
+   to respawn, so the CPU does nothing per particle, and nothing at all
+   once the last burst has burnt out */
+
+#define PARTICLE_EMITTERS 4	// bursts per frame, keep in step with Sample_GL_particle_update.vert
+#define PARTICLE_SPIKE 0
+#define PARTICLE_EXIT 1
+#define PARTICLE_LIFE 1.8	// longest lifetime the update shader hands out, seconds
+
+int particle_count = 1 << 16;	// --particles
+GLuint particle_update_program = 0, particle_draw_program = 0;
+GLuint particle_vao[2], particle_vbo[2];
+GLint particle_dt_id, particle_seed_id, particle_count_id, particle_emitters_id, particle_emitter_id, particle_slots_id;
+GLint particle_mvp_id, particle_scale_id;
+int particle_src = 0;	// buffer holding the current state
+int particle_cursor = 0;	// next ring slot to respawn
+int particle_seed = 0;
+double particle_last_step = 0, particle_live_until = -1;
+
+// Bursts waiting for the next step
+float particle_emit[PARTICLE_EMITTERS][4], particle_slots[PARTICLE_EMITTERS][4];
+int particle_emit_count = 0;
+
+void particleInit ()
+{
+	if (particle_count <= 0 || backend != &gl_backend)
+		return;
+	const char *feedback[2] = {"outPosVel", "outLife"};
+	particle_update_program = LoadShaders("Sample_GL_particle_update.vert", "Sample_GL_discard.frag", NULL, 2, feedback);
+	particle_dt_id = glGetUniformLocation(particle_update_program, "dt");
+	particle_seed_id = glGetUniformLocation(particle_update_program, "seed");
+	particle_count_id = glGetUniformLocation(particle_update_program, "particleCount");
+	particle_emitters_id = glGetUniformLocation(particle_update_program, "emitterCount");
+	particle_emitter_id = glGetUniformLocation(particle_update_program, "emitter");
+	particle_slots_id = glGetUniformLocation(particle_update_program, "emitterSlots");
+	particle_draw_program = LoadShaders("Sample_GL_particle.vert", "Sample_GL_particle.frag", split_view ? "#define VIEWS\n" : NULL);
+	viewRegister(particle_draw_program);
+	particle_mvp_id = glGetUniformLocation(particle_draw_program, "MVP");
+	particle_scale_id = glGetUniformLocation(particle_draw_program, "pointScale");
+	glUseProgram(programID);
+
+	// All zero is age 0 of lifetime 0, which is dead
+	vector<GLfloat> dead(8*particle_count, 0);
+	glGenVertexArrays(2, particle_vao);
+	glGenBuffers(2, particle_vbo);
+	for (int i=0; i < 2; i++) {
+		bindVertexArray(particle_vao[i]);
+		glBindBuffer(GL_ARRAY_BUFFER, particle_vbo[i]);
+		glBufferData(GL_ARRAY_BUFFER, dead.size()*sizeof(GLfloat), &dead[0], GL_DYNAMIC_COPY);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 8*sizeof(GLfloat), (void*)0);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 8*sizeof(GLfloat), (void*)(4*sizeof(GLfloat)));
+		if (gl_debug_labels) {
+			glObjectLabel(GL_VERTEX_ARRAY, particle_vao[i], -1, "particles");
+			glObjectLabel(GL_BUFFER, particle_vbo[i], -1, "particles");
+		}
+	}
+	glEnable(GL_PROGRAM_POINT_SIZE);
+	printf("particles: %d on the GPU\n", particle_count);
+}
+
+/* Respawn share of the pool (scaled by the quality level) at (x, y) in
+   world units. Returns 0 when the particle system is not running */
+int particleBurst (float x, float y, float share, int kind)
+{
+	if (!particle_update_program)
+		return 0;
+	if (particle_emit_count == PARTICLE_EMITTERS)
+		return 1;
+	int count = min(particle_count, max(1, (int)(particle_count * share * pellet_cap / 8)));
+	float emitter[4] = {x, y, kind == PARTICLE_EXIT ? 40.0f : 28.0f, (float)kind};
+	float slots[4] = {(float)particle_cursor, (float)count, 0, 0};
+	memcpy(particle_emit[particle_emit_count], emitter, sizeof(emitter));
+	memcpy(particle_slots[particle_emit_count], slots, sizeof(slots));
+	particle_emit_count++;
+	particle_cursor = (particle_cursor + count) % particle_count;
+	particle_live_until = glfwGetTime() + PARTICLE_LIFE;
+	return 1;
+}
+
+/* Is anything still flying? */
+int particlesLive ()
+{
+	return particle_emit_count > 0 || glfwGetTime() < particle_live_until;
+}
+
+/* Advance every particle by the time since the last step and draw them */
+void particleStep (const glm::mat4 &VP)
+{
+	double now = glfwGetTime();
+	float dt = min(now - particle_last_step, 0.05);
+	particle_last_step = now;
+	if (!particle_update_program || !particlesLive())
+		return;
+	int src = particle_src, dst = 1 - src;
+
+	gl_debug_object = "particles";
+	glUseProgram(particle_update_program);
+	glUniform1f(particle_dt_id, dt);
+	glUniform1i(particle_seed_id, particle_seed++);
+	glUniform1i(particle_count_id, particle_count);
+	glUniform1i(particle_emitters_id, particle_emit_count);
+	if (particle_emit_count > 0) {
+		glUniform4fv(particle_emitter_id, particle_emit_count, &particle_emit[0][0]);
+		glUniform4fv(particle_slots_id, particle_emit_count, &particle_slots[0][0]);
+	}
+	glEnable(GL_RASTERIZER_DISCARD);
+	bindVertexArray(particle_vao[src]);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, particle_vbo[dst]);
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, 0, particle_count);
+	glEndTransformFeedback();
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	glDisable(GL_RASTERIZER_DISCARD);
+	particle_src = dst;
+	particle_emit_count = 0;
+
+	int w, h;
+	sceneTarget(&w, &h);
+	glUseProgram(particle_draw_program);
+	glUniformMatrix4fv(particle_mvp_id, 1, GL_FALSE, &VP[0][0]);
+	glUniform1f(particle_scale_id, VP[0][0] * w / 2);
+	bindVertexArray(particle_vao[dst]);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+	viewDrawArrays(GL_POINTS, 0, particle_count);
+	glDisable(GL_BLEND);
+	glUseProgram(programID);
+}
+
+
+/**************************
+ * GPU tile culling       *
+ **************************/
+
+/* --gpu-tiles (GL backend): the obstacles and spikes of a level are one
+   buffer of tile instances (centre x, y and kind) instead of an object
+   each. When the view matrix or the level changes, Sample_GL_tile.geom
+   tests every tile against the view and transform feedback packs the
+   visible ones into a second buffer. Draws expand that buffer's points to
+   tiles and take the count from the transform feedback object
+   (ARB_transform_feedback2), so the CPU does no per-tile work and never
+   reads the count back. Without the extension all tiles are drawn and the
+   same geometry shader drops the hidden ones */
+
+#define TILE_BLOCK 0
+#define TILE_SPIKE 1
+
+int tile_gpu = 0;	// --gpu-tiles
+int tile_count = 0, tile_packed = 0;
+GLuint tile_vbo = 0, tile_visible_vbo = 0, tile_vao[2], tile_feedback = 0;
+GLuint tile_cull_program = 0, tile_draw_program = 0;
+GLint tile_cull_affine = -1, tile_draw_affine = -1, tile_draw_time = -1;
+GLfloat tile_packed_affine[8];	// view the visible buffer was packed for
+vector<GLfloat> tile_data;	// x, y, kind of each tile, built by createMap
+
+void tileInit ()
+{
+	if (!tile_gpu)
+		return;
+	// Obstacles and spikes come from the atlas only if it has both
+	int block = -1, spike = -1;
+	if (sprites_enabled && sprite_index.count("block") && sprite_index.count("spike")) {
+		block = sprite_index["block"];
+		spike = sprite_index["spike"];
+	}
+	string defines = shaderDefines(shader_base | (block >= 0 ? SHADER_TEXTURED : 0));
+	const char *feedback[] = {"visibleTile"};
+	tile_draw_program = LoadShaders("Sample_GL_tile.vert", "Sample_GL.frag", defines.c_str(), 0, NULL, "Sample_GL_tile.geom");
+	tile_draw_affine = glGetUniformLocation(tile_draw_program, "affine");
+	tile_draw_time = glGetUniformLocation(tile_draw_program, "time");
+	glUseProgram(tile_draw_program);
+	glUniform1i(glGetUniformLocation(tile_draw_program, "animate"), animation_enabled);
+	if (block >= 0) {
+		GLfloat uv[8];
+		memcpy(uv, &sprite_rects[block], 4*sizeof(GLfloat));
+		memcpy(uv+4, &sprite_rects[spike], 4*sizeof(GLfloat));
+		glUniform4fv(glGetUniformLocation(tile_draw_program, "tileUV"), 2, uv);
+		glUniform1i(glGetUniformLocation(tile_draw_program, "atlas"), 1);
+	}
+	if (GLAD_GL_ARB_transform_feedback2) {
+		tile_cull_program = LoadShaders("Sample_GL_tile.vert", "Sample_GL_discard.frag", "#define CULL\n", 1, feedback, "Sample_GL_tile.geom");
+		tile_cull_affine = glGetUniformLocation(tile_cull_program, "affine");
+		glGenTransformFeedbacks(1, &tile_feedback);
+	}
+	glUseProgram(programID);
+
+	glGenBuffers(1, &tile_vbo);
+	glGenBuffers(1, &tile_visible_vbo);
+	glGenVertexArrays(2, tile_vao);
+	GLuint source[2] = {tile_vbo, tile_visible_vbo};
+	for (int i=0; i < 2; i++) {
+		bindVertexArray(tile_vao[i]);
+		glBindBuffer(GL_ARRAY_BUFFER, source[i]);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	}
+	if (gl_debug_labels) {
+		glObjectLabel(GL_BUFFER, tile_vbo, -1, "tiles");
+		glObjectLabel(GL_BUFFER, tile_visible_vbo, -1, "visible_tiles");
+	}
+	printf("gpu tiles: %s\n", tile_feedback ? "culled into a packed buffer" : "culled while drawing");
+}
+
+/* Queue a tile for the next tileUpload */
+void tileAdd (float x, float y, int kind)
+{
+	tile_data.push_back(x);
+	tile_data.push_back(y);
+	tile_data.push_back(kind);
+}
+
+/* Hand the level's tiles to the GPU, colours from createMap */
+void tileUpload (const float *block_color, const float *spike_color)
+{
+	if (!tile_gpu)
+		return;
+	tile_count = tile_data.size()/3;
+	size_t size = max(tile_data.size(), (size_t)3)*sizeof(GLfloat);
+	glBindBuffer(GL_ARRAY_BUFFER, tile_vbo);
+	glBufferData(GL_ARRAY_BUFFER, size, tile_data.empty() ? NULL : &tile_data[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, tile_visible_vbo);
+	glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_DYNAMIC_COPY);
+	tile_data.clear();
+	tile_packed = 0;
+
+	GLfloat color[8] = {block_color[0], block_color[1], block_color[2], 1, spike_color[0], spike_color[1], spike_color[2], 1};
+	glUseProgram(tile_draw_program);
+	glUniform4fv(glGetUniformLocation(tile_draw_program, "tileColor"), 2, color);
+	glUseProgram(programID);
+}
+
+/* Pack the tiles visible under affine into tile_visible_vbo */
+void tileCull (const GLfloat *affine)
+{
+	glUseProgram(tile_cull_program);
+	glUniform4fv(tile_cull_affine, 2, affine);
+	glEnable(GL_RASTERIZER_DISCARD);
+	bindVertexArray(tile_vao[0]);
+	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, tile_feedback);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, tile_visible_vbo);
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, 0, tile_count);
+	glEndTransformFeedback();
+	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+	glDisable(GL_RASTERIZER_DISCARD);
+	memcpy(tile_packed_affine, affine, sizeof(tile_packed_affine));
+	tile_packed = 1;
+}
+
+/* Draw every obstacle and spike under VP in one call */
+void tileDraw (const Affine2 &VP)
+{
+	if (!tile_gpu || !tile_count)
+		return;
+	GLfloat affine[8];
+	affinePack(VP, affine);
+	if (tile_feedback && (!tile_packed || memcmp(affine, tile_packed_affine, sizeof(affine))))
+		tileCull(affine);
+
+	gl_debug_object = "tiles";
+	glUseProgram(tile_draw_program);
+	glUniform4fv(tile_draw_affine, 2, affine);
+	glUniform1f(tile_draw_time, anim_time);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	if (tile_feedback) {
+		bindVertexArray(tile_vao[1]);
+		glDrawTransformFeedback(GL_POINTS, tile_feedback);
+	}
+	else {
+		bindVertexArray(tile_vao[0]);
+		glDrawArrays(GL_POINTS, 0, tile_count);
+	}
+	glUseProgram(programID);
+}
+
+/**************************
+ * Hazard batch           *
+ **************************/
+
+/* Moving spikes drawn from the mesh buffer (GL backend, no atlas sprite)
+   are one instanced draw of the first spike's mesh. Every spike is the
+   same diamond in the same colour, so an instance only carries its centre
+   and motion phase (Sample_GL_hazard.vert). Spikes that use the atlas are
+   batched by the sprite queue instead */
+
+int hazard_count = 0;	// spike instances in hazard_vbo, 0 to draw them one by one
+GLuint hazard_program = 0, hazard_vao = 0, hazard_vbo = 0;
+GLint hazard_affine_id, hazard_time_id, hazard_views_id;
+int hazard_divisor = 1;
+
+void hazardInit ()
+{
+	if (!animation_enabled || tile_gpu)
+		return;
+	hazard_program = LoadShaders("Sample_GL_hazard.vert", "Sample_GL.frag", shaderDefines(shader_base).c_str());
+	viewRegister(hazard_program);
+	hazard_affine_id = glGetUniformLocation(hazard_program, "affine");
+	hazard_time_id = glGetUniformLocation(hazard_program, "time");
+	hazard_views_id = glGetUniformLocation(hazard_program, "viewCount");
+	glUseProgram(programID);
+
+	// Mesh vertices come from the shared mesh buffer, instances from our own
+	glGenVertexArrays(1, &hazard_vao);
+	glGenBuffers(1, &hazard_vbo);
+	bindVertexArray(hazard_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh_vbo);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, MESH_FLOATS*sizeof(GLfloat), (void*)0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, MESH_FLOATS*sizeof(GLfloat), (void*)(3*sizeof(GLfloat)));
+	glBindBuffer(GL_ARRAY_BUFFER, hazard_vbo);
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	glVertexAttribDivisor(2, hazard_divisor);
+	if (gl_debug_labels) {
+		glObjectLabel(GL_VERTEX_ARRAY, hazard_vao, -1, "spikes");
+		glObjectLabel(GL_BUFFER, hazard_vbo, -1, "spikes");
+	}
+}
+
+/* Hand the spikes createMap just placed to the GPU */
+void hazardUpload ()
+{
+	hazard_count = 0;
+	if (!hazard_vbo || arr_s.empty() || arr_s[0]->Sprite >= 0)
+		return;
+	vector<GLfloat> data;
+	for (size_t i=0; i < s.size(); i++) {
+		data.push_back(s[i].x);
+		data.push_back(s[i].y);
+		data.push_back(arr_s[i]->Motion[1]);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, hazard_vbo);
+	glBufferData(GL_ARRAY_BUFFER, data.size()*sizeof(GLfloat), &data[0], GL_STATIC_DRAW);
+	hazard_count = s.size();
+}
+
+/* Draw every spike under VP in one call */
+void hazardDraw (const Affine2 &VP)
+{
+	GLfloat affine[8];
+	affinePack(VP, affine);
+	gl_debug_object = "spikes";
+	glUseProgram(hazard_program);
+	glUniform4fv(hazard_affine_id, 2, affine);
+	glUniform1f(hazard_time_id, anim_time);
+	glUniform1i(hazard_views_id, view_count);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	bindVertexArray(hazard_vao);
+	// One instance per spike and view, the views of a spike side by side
+	if (hazard_divisor != view_count) {
+		hazard_divisor = view_count;
+		glVertexAttribDivisor(2, hazard_divisor);
+	}
+	glDrawArraysInstanced(GL_TRIANGLES, arr_s[0]->MeshFirst, arr_s[0]->NumVertices, hazard_count*view_count);
+	glUseProgram(programID);
+}
+
+/**************************
+ * Tile level of detail   *
+ **************************/
+
+/* Zoomed out over a big level, tiles shrink below a pixel and drawing each
+   one is wasted work. createMap builds a pyramid of obstacle occupancy,
+   each level halving the grid and marking a block if any of its four
+   children is set, and makes every level one mesh of blocks. drawStatic
+   draws the finest level whose blocks still cover lod_pixels, so the
+   obstacles never cost more than a block per pixel. Not built with
+   --gpu-tiles, which draws obstacles and spikes together */
+
+#define TILE_LODS 8	// level 0 is the tiles themselves
+
+float lod_pixels = 1;	// --lod-pixels, smallest tile still drawn on its own
+VAO *tile_lod[TILE_LODS];
+int tile_lods = 0;	// levels built for the current map
+
+/* Rebuild the pyramid from the obstacles createMap just placed */
+void tileLodBuild (const float *color)
+{
+	for (int i=1; i < tile_lods; i++)
+		free3DObject(tile_lod[i]);
+	tile_lods = 0;
+	if (tile_gpu || obst.empty())
+		return;
+
+	// Tile (x, y) covers x..x+1, y..y+1 in world units
+	int w = 1, h = 1;
+	for (size_t i=0; i < obst.size(); i++) {
+		w = max(w, (int)floor(obst[i].x) + 1);
+		h = max(h, (int)floor(obst[i].y) + 1);
+	}
+	vector<unsigned char> grid(w*h, 0);
+	for (size_t i=0; i < obst.size(); i++) {
+		int x = floor(obst[i].x), y = floor(obst[i].y);
+		if (x >= 0 && y >= 0)
+			grid[y*w + x] = 1;
+	}
+
+	tile_lods = 1;
+	while (tile_lods < TILE_LODS && (w > 1 || h > 1)) {
+		int cw = (w + 1)/2, ch = (h + 1)/2;
+		vector<unsigned char> coarse(cw*ch, 0);
+		for (int y=0; y < h; y++) {
+			for (int x=0; x < w; x++) {
+				if (grid[y*w + x])
+					coarse[(y/2)*cw + x/2] = 1;
+			}
+		}
+		grid.swap(coarse);
+		w = cw;
+		h = ch;
+
+		float size = 1 << tile_lods;
+		vector<GLfloat> verts;
+		for (int y=0; y < h; y++) {
+			for (int x=0; x < w; x++) {
+				if (!grid[y*w + x])
+					continue;
+				float x0 = x*size, y0 = y*size, x1 = x0 + size, y1 = y0 + size;
+				GLfloat quad[18] = {x0,y0,0, x1,y0,0, x1,y1,0, x0,y0,0, x1,y1,0, x0,y1,0};
+				verts.insert(verts.end(), quad, quad + 18);
+			}
+		}
+		tile_lod[tile_lods] = create3DObject(GL_TRIANGLES, verts.size()/3, &verts[0], color[0], color[1], color[2]);
+		nameObject(tile_lod[tile_lods], "obstacle_lod");
+		tile_lods++;
+	}
+}
+
+/* Pixels across the target draw() renders into. Every backend measures
+   fb_w in its begin frame */
+int sceneWidth ()
+{
+	return max(1, (int)(fb_w*min(render_scale_lod[quality], 1.0f)));
+}
+
+/* Pyramid level to draw the obstacles at under VP on a target pixels
+   wide, 0 for the tiles themselves */
+int tileLodLevel (const Affine2 &VP, int pixels)
+{
+	float tile = fabs(VP.m[0])*pixels/2;	// pixels across one tile
+	int lod = 0;
+	while (lod + 1 < tile_lods && tile < lod_pixels) {
+		tile *= 2;
+		lod++;
+	}
+	return lod;
+}
+
+// Cached transforms of the level's tiles, HUD frames, digits and walls
+int static_nodes = 0;	// nodes kept across levels, the tiles of the current level follow
+int recp_node, recball_node, floor_node[2], wall_node[2], digit_node, segment_node[7];
+vector<int> obst_node, s_node;
+
+void createStaticNodes ()
+{
+	Affine2 identity = affineTranslate(0, 0);
+	float upright = M_PI/2;
+
+	recp_node = xformNode(-1, identity);
+	recball_node = xformNode(-1, identity);
+	floor_node[0] = xformNode(-1, affineTranslate(0, 45));
+	floor_node[1] = xformNode(-1, identity);
+	wall_node[0] = xformNode(-1, affineTranslate(95, 0));
+	wall_node[1] = xformNode(-1, identity);
+
+	// Seven segments of the level digit, placed around its centre
+	digit_node = xformNode(-1, affineTranslate(88.85, 48.9));
+	segment_node[0] = xformNode(digit_node, affineTranslateRotate(1.15, -0.75, upright));
+	segment_node[1] = xformNode(digit_node, affineTranslate(0, 1.6));
+	segment_node[2] = xformNode(digit_node, affineTranslateRotate(1.15, 0.75, upright));
+	segment_node[3] = xformNode(digit_node, identity);
+	segment_node[4] = xformNode(digit_node, affineTranslateRotate(-1.15, 0.75, upright));
+	segment_node[5] = xformNode(digit_node, affineTranslate(0, -1.65));
+	segment_node[6] = xformNode(digit_node, affineTranslateRotate(-1.15, -0.75, upright));
+
+	static_nodes = xform_nodes.size();
+}
+
+void drawCached (int node, VAO* vao)
+{
+	backend->setMVP(xformMVP(node));
+	draw3DObject(vao);
+}
+
+/* Spikes, and with --gpu-tiles every tile. While they are animated these
+   are drawn each frame instead of going into the static layer, in one call
+   from the hazard batch, the tiles or the sprite queue; the motion itself
+   is all in the vertex shader */
+void drawHazards (const Affine2 &VP)
+{
+	xformSetVP(VP);
+	tileDraw(VP);
+	if (hazard_count) {
+		hazardDraw(VP);
+		return;
+	}
+	for( int i=0;i < arr_s.size();i++){
+		drawCached(s_node[i], arr_s[i]);
+	}
+}
+
+/* The part of the scene under everything else that only changes with the
+   camera box or the level, on a target pixels wide: obstacles and still
+   spikes. This is what the static layer caches */
+void drawStatic (const Affine2 &VP, int pixels)
+{
+	// Matrices are only rebuilt here when the camera moved
+	xformSetVP(VP);
+
+	// Empty with --gpu-tiles, which draws them with the spikes instead
+	int lod = tileLodLevel(VP, pixels);
+	if (lod > 0) {
+		backend->setMVP(VP);
+		draw3DObject(tile_lod[lod]);
+	}
+	else {
+		for( int i=0;i < arr_obs.size();i++){
+			drawCached(obst_node[i], arr_obs[i]);
+		}
+	}
+
+	if (!animation_enabled)
+		drawHazards(VP);
+
+	// Obstacles and spikes that use the atlas
+	spriteFlush();
+}
+
+/* The static objects drawn over the moving ones. They go in the same place
+   in draw() as they always did, so the ball, key and exit stay under the
+   walls and the HUD counters over their frames */
+void drawHudFrames ()
+{
+	drawCached(recp_node, recp);
+	drawCached(recball_node, recball);
+}
+
+void drawDigits ()
+{
+	if(level != 2){
+		drawCached(segment_node[0], score);
+	}
+	if (level != 1 && level !=4){
+		drawCached(segment_node[1], score);
+	}
+	if(level != 5 && level != 6){
+		drawCached(segment_node[2], score);
+	}
+	if(level != 1 && level != 7 && level != 0){
+		drawCached(segment_node[3], score);
+	}
+	if(level != 1 && level != 3 && level !=2 && level != 7){
+		drawCached(segment_node[4], score);
+	}
+	if(level != 1 && level != 4 && level != 7 ){
+		drawCached(segment_node[5], score);
+	}
+	if(level == 2 || level == 6 || level == 8 || level == 0){
+		drawCached(segment_node[6], score);
+	}
+	spriteFlush();
+}
+
+void drawWalls ()
+{
+	drawCached(floor_node[0], rectb);
+	drawCached(wall_node[0], recs);
+	drawCached(floor_node[1], rectb);
+	drawCached(wall_node[1], recs);
+}
+
+/**************************
+ * Minimap                *
+ **************************/
+
+/* While zoomed in, a thumbnail of the whole 96x54 level sits in the bottom
+   right corner (GL backend, --no-minimap to drop it). The static part is
+   drawn with drawStatic into a small texture once per level; each frame
+   only blits that texture and draws the ball, key and exit as instanced
+   points (Sample_GL_marker.vert, round points from Sample_GL_particle.frag) */
+
+#define MINIMAP_W 192
+#define MINIMAP_H 108
+#define MINIMAP_MARKERS 3
+
+int minimap_enabled = 1, minimap_valid = 0;
+GLuint minimap_fbo = 0, minimap_tex = 0, minimap_program = 0, minimap_vao = 0, minimap_vbo = 0;
+GLint minimap_rect_id;
+
+void minimapInit ()
+{
+	if (!minimap_enabled || backend != &gl_backend) {
+		minimap_enabled = 0;
+		return;
+	}
+	glGenFramebuffers(1, &minimap_fbo);
+	glGenTextures(1, &minimap_tex);
+	glBindTexture(GL_TEXTURE_2D, minimap_tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, MINIMAP_W, MINIMAP_H, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindFramebuffer(GL_FRAMEBUFFER, minimap_fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, minimap_tex, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	minimap_program = LoadShaders("Sample_GL_marker.vert", "Sample_GL_particle.frag");
+	minimap_rect_id = glGetUniformLocation(minimap_program, "mapRect");
+	glUseProgram(programID);
+
+	glGenVertexArrays(1, &minimap_vao);
+	glGenBuffers(1, &minimap_vbo);
+	bindVertexArray(minimap_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, minimap_vbo);
+	glBufferData(GL_ARRAY_BUFFER, MINIMAP_MARKERS*8*sizeof(GLfloat), NULL, GL_DYNAMIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 8*sizeof(GLfloat), (void*)0);
+	glVertexAttribDivisor(0, 1);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 8*sizeof(GLfloat), (void*)(4*sizeof(GLfloat)));
+	glVertexAttribDivisor(1, 1);
+	glEnable(GL_PROGRAM_POINT_SIZE);
+	if (gl_debug_labels) {
+		glObjectLabel(GL_TEXTURE, minimap_tex, -1, "minimap");
+		glObjectLabel(GL_VERTEX_ARRAY, minimap_vao, -1, "minimap_markers");
+		glObjectLabel(GL_BUFFER, minimap_vbo, -1, "minimap_markers");
+	}
+}
+
+/* The level changed, draw its thumbnail again before it is next shown */
+void invalidateMinimap ()
+{
+	minimap_valid = 0;
+}
+
+/* Draw the static scene for the whole level into the minimap texture */
+void minimapRender ()
+{
+	gl_debug_object = "minimap";
+	glBindFramebuffer(GL_FRAMEBUFFER, minimap_fbo);
+	glViewport(0, 0, MINIMAP_W, MINIMAP_H);
+	glClearColor(0.05f, 0.05f, 0.08f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glClearColor(0.2f, 0.2f, 0.2f, 0.2f);
+	glm::mat4 level_vp = glm::ortho(0.0f, 96.0f, 0.0f, 54.0f, 0.1f, 500.0f) * Matrices.view;
+	// The thumbnail is one view of the whole level
+	viewsUse(1);
+	drawStatic(affineFromMat4(level_vp), MINIMAP_W);
+	// Moving spikes are caught wherever they are when the level starts
+	if (animation_enabled) {
+		drawHazards(affineFromMat4(level_vp));
+		spriteFlush();
+	}
+	drawHudFrames();
+	drawDigits();
+	drawWalls();
+	minimap_valid = 1;
+}
+
+void minimapDraw ()
+{
+	// Only needed when part of the level is off screen
+	if (!minimap_enabled || x_2 - x_1 >= 96)
+		return;
+	gpuPass(PASS_HUD);
+	if (!minimap_valid)
+		minimapRender();
+
+	int w, h;
+	GLuint target = sceneTarget(&w, &h);
+	int mw = max(16, w/5), mh = mw*MINIMAP_H/MINIMAP_W, margin = max(2, w/100);
+	int mx = w - mw - margin, my = margin;
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, minimap_fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+	glBlitFramebuffer(0, 0, MINIMAP_W, MINIMAP_H, mx, my, mx+mw, my+mh, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	glBindFramebuffer(GL_FRAMEBUFFER, target);
+	glViewport(0, 0, w, h);
+
+	// Ball, then the key until it is picked up, then the exit
+	float size = max(3.0f, mw/24.0f);
+	GLfloat markers[MINIMAP_MARKERS][8];
+	int count = 0;
+	float ball[8] = {(float)(flag == 1 ? x_proj+5 : 5), (float)(flag == 1 ? y_proj+5 : 5), size, 0, 1, 1, 0, 1};
+	memcpy(markers[count++], ball, sizeof(ball));
+	if (pass == 0 && k_pos_x > 0) {
+		float key_marker[8] = {(float)k_pos_x, (float)k_pos_y, 1.3f*size, 0, 1, 0.3, 1, 1};
+		memcpy(markers[count++], key_marker, sizeof(key_marker));
+	}
+	if (e_pos_x > 0) {
+		float exit_marker[8] = {(float)e_pos_x, (float)e_pos_y, 1.3f*size, 0, 0.3, 1, 1, 1};
+		memcpy(markers[count++], exit_marker, sizeof(exit_marker));
+	}
+
+	gl_debug_object = "minimap";
+	glDisable(GL_DEPTH_TEST);
+	glUseProgram(minimap_program);
+	glUniform4f(minimap_rect_id, 2.0f*mx/w - 1, 2.0f*my/h - 1, 2.0f*mw/w, 2.0f*mh/h);
+	bindVertexArray(minimap_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, minimap_vbo);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, count*sizeof(markers[0]), markers);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glDrawArraysInstanced(GL_POINTS, 0, 1, count);
+	glDisable(GL_BLEND);
+	glEnable(GL_DEPTH_TEST);
+	glUseProgram(programID);
+}
+
+/* Render the scene with openGL */
+/* Edit this function according to your assignment */
+void draw ()
+{
+	// The static layer is timed as world
+	gpuPass(PASS_WORLD);
+	backend->clear();
+	overdrawBegin();
+
+	// Eye - Location of camera. Don't change unless you are sure!!
+	glm::vec3 eye ( 5*cos(camera_rotation_angle*M_PI/180.0f), 0, 5*sin(camera_rotation_angle*M_PI/180.0f) );
+	// Target - Where is the camera looking at.  Don't change unless you are sure!!
+	glm::vec3 target (0, 0, 0);
+	// Up - Up vector defines tilt of camera.  Don't change unless you are sure!!
+	glm::vec3 up (0, 1, 0);
+
+	//Compute Camera matrix (view)
+	//Matrices.view = glm::lookAt( eye, target, up ); // Rotating Camera for 3D
+	//  Don't change unless you are sure!!
+	Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0)); // Fixed camera for 2D (ortho) in XY plane
+
+	// Compute ViewProject matrix as view/camera might not be changed for this frame (basic scenario)
+	//  Don't change unless you are sure!!
+	glm::mat4 VP = Matrices.projection * Matrices.view;
+
+	// Send our transformation to the currently bound shader, in the "affine" uniform
+	// For each model you render, since the MVP will be different (at least the M part)
+	// The scene is flat, so per object work is done on the 2D part of VP
+	Affine2 VP2D = affineFromMat4(VP);
+
+	// Split views are placed around the same camera box, once a frame
+	float cam[4] = {x_1, x_2, y_1, y_2};
+	splitViewUpdate(cam, e_pos_x, e_pos_y);
+	viewsUse(0);
+	viewsClip(1);
+
+	// Load identity to model matrix
+	//Matrices.model = glm::mat4(1.0f);
+
+	/* Render your scene */
+
+	///glm::mat4 translateTriangle = glm::translate (glm::vec3(-2.0f, 0.0f, 0.0f)); // glTranslatef
+	///glm::mat4 rotateTriangle = glm::rotate((float)(triangle_rotation*M_PI/180.0f), glm::vec3(0,0,1));  // rotate about vector (1,0,0)
+	///glm::mat4 triangleTransform = translateTriangle * rotateTriangle;
+	///Matrices.model *= triangleTransform; 
+	///MVP = VP * Matrices.model; // MVP = p * V * M
+
+	//  Don't change unless you are sure!!
+	///backend->setMVP(MVP);
+
+	// draw3DObject draws the VAO given to it using current MVP matrix
+//	draw3DObject(triangle);
+
+	// Pop matrix to undo transformations till last push matrix instead of recomputing model matrix
+	// glPopMatrix ();
+	///rectangle_rotation = rectangle_rotation + increments*rectangle_rot_dir*rectangle_rot_status;
+	// Obstacles and spikes; cached on the GL backend. The static objects
+	// drawn over the rest follow below, placed by the same matrices
+	xformSetVP(VP2D);
+	if (!staticLayerComposite()) {
+		staticLayerBegin();
+		drawStatic(VP2D, sceneWidth());
+		staticLayerEnd();
+	}
+	if (animation_enabled) {
+		drawHazards(VP2D);
+		spriteFlush();
+	}
+
+//------------------------------------------------
+	for(int i=0;i<s.size();i++)
+	{
+		if( sqrt( pow((x_proj-s[i][0]+5),2)+pow((y_proj-s[i][1]+5),2) ) < 1 ){
 
             prick = 1;     
 			flag =0;
@@ -1029,6 +4570,9 @@ void draw ()
 			y_p=y_proj;
 			x_p1 = x_p2=x_p4=x_p5=x_p6=x_p8=0;
 			y_p2 = y_p3=y_p4=y_p6=y_p7=y_p8=0;
+			// GPU particles take over from the eight pellets when they are running
+			if (particleBurst(x_proj+5, y_proj+5, 0.125, PARTICLE_SPIKE))
+				prick = 0;
 			if(level!=0){
 				//n--;
 			}
@@ -1042,7 +4586,7 @@ void draw ()
 
 	if (prick == 1)
 	{
-
+		gpuPass(PASS_EFFECTS);
 
 		vel-=0.07*vel;
 		if(vel<0.01){
@@ -1050,81 +4594,62 @@ void draw ()
 		}
 
 		x_p1 = x_p1 + vel;
-		Matrices.model = glm::mat4(1.0f);
-		glm::mat4 translatesmall1 = glm::translate(glm::vec3(x_p+x_p1+5,y_p+5,0));
-		Matrices.model *=  (translatesmall1);
-		MVP = VP * Matrices.model;
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(small);
+		backend->setMVP(VP2D * affineTranslate(x_p+x_p1+5, y_p+5));
+		if (pellet_rank[1] < pellet_cap)
+			draw3DObject(small);
 
 		x_p2 = x_p2 +  vel/1.414;
 		y_p2  = y_p2 +vel/1.414;
-		Matrices.model = glm::mat4(1.0f);
-		glm::mat4 translatesmall2 = glm::translate (glm::vec3(x_p+x_p2+5,y_p+y_p2+5,0));
-		Matrices.model *=  (translatesmall2 );
-		MVP = VP * Matrices.model;
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(small);
+		backend->setMVP(VP2D * affineTranslate(x_p+x_p2+5, y_p+y_p2+5));
+		if (pellet_rank[2] < pellet_cap)
+			draw3DObject(small);
 
 		y_p3 = y_p3 + vel;
 
-		Matrices.model = glm::mat4(1.0f);
-		glm::mat4 translatesmall3 = glm::translate (glm::vec3(x_p+5,y_p+y_p3+5,0));
-		Matrices.model *=  (translatesmall3 );
-		MVP = VP * Matrices.model;
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(small);
+		backend->setMVP(VP2D * affineTranslate(x_p+5, y_p+y_p3+5));
+		if (pellet_rank[3] < pellet_cap)
+			draw3DObject(small);
 
 		x_p4  = x_p4 - vel/1.414;
 		y_p4  = y_p4 + vel/1.414;
 
-		Matrices.model = glm::mat4(1.0f);
-		glm::mat4 translatesmall4 = glm::translate (glm::vec3(x_p+5+x_p4,y_p+y_p4+5,0));
-		Matrices.model *=  (translatesmall4 );
-		MVP = VP * Matrices.model;
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(small);
+		backend->setMVP(VP2D * affineTranslate(x_p+5+x_p4, y_p+y_p4+5));
+		if (pellet_rank[4] < pellet_cap)
+			draw3DObject(small);
 
 		x_p5  = x_p5-vel;
 
-		Matrices.model = glm::mat4(1.0f);
-		glm::mat4 translatesmall5 = glm::translate (glm::vec3(x_p+5+x_p5,y_p+5,0));
-		Matrices.model *=  (translatesmall5 );
-		MVP = VP * Matrices.model;
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(small);
+		backend->setMVP(VP2D * affineTranslate(x_p+5+x_p5, y_p+5));
+		if (pellet_rank[5] < pellet_cap)
+			draw3DObject(small);
 
 		x_p6  = x_p6-vel/1.414;
 		y_p6  = y_p6-vel/1.414;
 
-		Matrices.model = glm::mat4(1.0f);
-		glm::mat4 translatesmall6 = glm::translate (glm::vec3(x_p+5+x_p6,y_p+y_p6+5,0));
-		Matrices.model *=  (translatesmall6 );
-		MVP = VP * Matrices.model;
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(small);
+		backend->setMVP(VP2D * affineTranslate(x_p+5+x_p6, y_p+y_p6+5));
+		if (pellet_rank[6] < pellet_cap)
+			draw3DObject(small);
 
 		y_p7  =y_p7- vel;
 
-		Matrices.model = glm::mat4(1.0f);
-		glm::mat4 translatesmall7 = glm::translate (glm::vec3(x_p+5,y_p+y_p7+5,0));
-		Matrices.model *=  (translatesmall7 );
-		MVP = VP * Matrices.model;
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(small);
+		backend->setMVP(VP2D * affineTranslate(x_p+5, y_p+y_p7+5));
+		if (pellet_rank[7] < pellet_cap)
+			draw3DObject(small);
 
 		x_p8  = x_p8 + vel/1.414;
 		y_p8  = y_p8-vel/1.414;
 
-		Matrices.model = glm::mat4(1.0f);
-		glm::mat4 translatesmall8 = glm::translate (glm::vec3(x_p+5+x_p8,y_p+y_p8+5,0));
-		Matrices.model *=  (translatesmall8 );
-		MVP = VP * Matrices.model;
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(small); 
+		backend->setMVP(VP2D * affineTranslate(x_p+5+x_p8, y_p+y_p8+5));
+		if (pellet_rank[8] < pellet_cap)
+			draw3DObject(small);
 
+		gpuPass(PASS_WORLD);
 	}
 
+	gpuPass(PASS_EFFECTS);
+	particleStep(VP);
+	gpuPass(PASS_WORLD);
+
 
 
 
@@ -1136,12 +4661,7 @@ void draw ()
 	if (keyboard_movement == 1 or keyboard_movement == -1){
 		rectangle_rotation += 0.01 * keyboard_movement;
 	}
-	Matrices.model = glm::mat4(1.0f);
-	glm::mat4 translateRectangle = glm::translate (glm::vec3(5, 5, 0));
-	glm::mat4 rotateRectangle = glm::rotate((float)(rectangle_rotation), glm::vec3(0,0,1)); 
-	Matrices.model *=  (translateRectangle * rotateRectangle);
-	MVP = VP * Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+	backend->setMVP(VP2D * affineTranslateRotate(5, 5, rectangle_rotation));
 
 
 	// draw3DObject draws the VAO given to it using current MVP matrix
@@ -1175,13 +4695,10 @@ void draw ()
 	
 
 	if (flag == 0){
-		Matrices.model = glm::mat4(1.0f);
-
-		
 		//glm::mat4 translateball = glm::translate (glm::vec3(6*cos(rectangle_rotation), 6*sin(rectangle_rotation), 0));
 		//Matrices.model *=  (translateball );
-		MVP = VP * Matrices.model;
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+		trailReset();
+		backend->setMVP(VP2D);
 			//Matrices.model *=  (translateRectangle );
 		draw3DObject(ball);
 		/*if (mouse_movement == 1){
@@ -1198,13 +4715,12 @@ void draw ()
 
 	}
 	if (flag == 1 && n>0) {
-		Matrices.model = glm::mat4(1.0f);
+		trailPush(x_proj+5, y_proj+5);
+		gpuPass(PASS_EFFECTS);
+		trailDraw(VP);
+		gpuPass(PASS_WORLD);
 
-		
-		glm::mat4 translateball = glm::translate (glm::vec3(x_proj, y_proj, 0));
-		Matrices.model *=  (translateball );
-		MVP = VP * Matrices.model;
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+		backend->setMVP(VP2D * affineTranslate(x_proj, y_proj));
 		
 		draw3DObject(ball);
 		
@@ -1235,11 +4751,17 @@ void draw ()
 		}
 		double R = 0.8535533;
 		double K = 1.2071067;
+		DEBUG_ARROW(x_proj+5, y_proj+5, 8*v_x, 8*v_y, 0, 1, 0);
 		for (int i = 0; i < obst.size();i++)
 		{ 
 			double x2 = obst[i][0]-5, y2 = obst[i][1] -5 ;
 			
 			double d = sqrt(pow((x_proj-x2),2) + pow((y_proj-y2),2));
+			// Tiles near the ball, with the distance that counts as a hit
+			if (d < 3*K) {
+				DEBUG_BOX(x2+4.5, y2+4.5, x2+5.5, y2+5.5, 0.6, 0.6, 0.6);
+				DEBUG_CIRCLE(x2+5, y2+5, K, 0.3, 0.3, 1);
+			}
 			if( d < K) {
 				
 				
@@ -1254,6 +4776,8 @@ void draw ()
 						v_y = -0.8 * v_y;
 						y_proj = y2 + K;
 					}
+					// Contact normals, one colour per branch
+					DEBUG_ARROW(x_proj+5, y_proj+5, 0, y_proj > y2 ? 1.5 : -1.5, 1, 0, 0);
 				
 					
 				}
@@ -1268,6 +4792,7 @@ void draw ()
 						v_x = -0.8*v_x;
 						x_proj = x2 - K;
 					}
+					DEBUG_ARROW(x_proj+5, y_proj+5, x_proj > x2 ? 1.5 : -1.5, 0, 1, 0.5, 0);
 					
 				}
 				else if(x_proj > x2 + R )
@@ -1280,6 +4805,7 @@ void draw ()
 						v_x = -0.8 *v_x;
 						x_proj = x2 + K;
 					}
+					DEBUG_ARROW(x_proj+5, y_proj+5, x_proj > x2 ? 1.5 : -1.5, 0, 1, 0, 1);
 					
 
 				}
@@ -1294,6 +4820,7 @@ void draw ()
 						v_y = -0.8*v_y;
 						y_proj = y2 - K;
 					}
+					DEBUG_ARROW(x_proj+5, y_proj+5, 0, y_proj > y2 ? 1.5 : -1.5, 0, 1, 1);
 					
 				}
 				
@@ -1304,23 +4831,30 @@ void draw ()
 		}
 
 	}
+#ifdef DEBUG_DRAW
+	// Where the ball goes from here under gravity and drag alone, ignoring bounces
+	if (flag == 0 || n > 0) {
+		double px = x_proj+5, py = y_proj+5, pvx = v_x, pvy = v_y;
+		for (int i=0; i < 90; i++) {
+			pvy -= a_y;
+			pvx -= pvx*a_x;
+			DEBUG_LINE(px, py, px+pvx, py+pvy, 1, 1, 1);
+			px += pvx;
+			py += pvy;
+		}
+	}
+#endif
 	if ( sqrt( pow((x_proj-k_pos_x+5),2)+pow((y_proj-k_pos_y+5),2) ) < 1.8 ){
 		pass = 1;
 	}  
 	if (pass == 0){
-		Matrices.model = glm::mat4(1.0f);
-		glm::mat4 translatekey = glm::translate (glm::vec3(k_pos_x,k_pos_y,0));
-		Matrices.model *=  (translatekey);
-		MVP = VP * Matrices.model;
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+		backend->setMVP(VP2D * affineTranslate(k_pos_x, k_pos_y));
 		draw3DObject(key);
 	}
-	Matrices.model = glm::mat4(1.0f);
-	glm::mat4 translatekey = glm::translate (glm::vec3(e_pos_x,e_pos_y,0));
-	Matrices.model *=  (translatekey);
-	MVP = VP * Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+	backend->setMVP(VP2D * affineTranslate(e_pos_x, e_pos_y));
 	draw3DObject(ex);
+	// Key and exit sprites go out before the HUD draws over them
+	spriteFlush();
 	if (pass == 1)
 	{
 		if ( sqrt( pow((x_proj-e_pos_x+5),2)+pow((y_proj-e_pos_y+5),2) ) < 2.3)
@@ -1328,192 +4862,58 @@ void draw ()
 			pass = 0;
 			inc = 1;
 		    level++;
+			particleBurst(e_pos_x, e_pos_y, 0.5, PARTICLE_EXIT);
 		}
 		
 	}
 
 
-	Matrices.model = glm::mat4(1.0f);
-	MVP = VP * Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	draw3DObject(recp);
-	Matrices.model = glm::mat4(1.0f);
-	MVP = VP * Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	draw3DObject(recball);
-
-
+	gpuPass(PASS_HUD);
+	drawHudFrames();
 	for(int i=0;i<n;i++){
 
 		if(i<10 ){
 
 
-			Matrices.model = glm::mat4(1.0f);
-			glm::mat4 translateTriangle = glm::translate (glm::vec3(40+1.5*i-4,50.5-5, 0));
-			Matrices.model *=  (translateTriangle);
-			MVP = VP * Matrices.model;
-			glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+			backend->setMVP(VP2D * affineTranslate(40+1.5*i-4, 50.5-5));
 			draw3DObject(ball);
 		}
 
 		if(i>=10)
 		{
-			Matrices.model = glm::mat4(1.0f);
-			glm::mat4 translateTriangle = glm::translate (glm::vec3(40+1.5*(i-10)-4,48.5-5, 0));
-			Matrices.model *=  (translateTriangle);
-			MVP = VP * Matrices.model;
-			glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+			backend->setMVP(VP2D * affineTranslate(40+1.5*(i-10)-4, 48.5-5));
 			draw3DObject(ball);
 		}
 	}
+	drawDigits();
 
 		
-	// score 
-
-	if(level != 2){
-		Matrices.model = glm::mat4(1.0f);
-		glm::mat4 translateTriangle = glm::translate (glm::vec3(90,48.15, 0));
-		glm::mat4 rotatedf = glm::rotate((float)(M_PI/2), glm::vec3(0,0,1)); 
-		Matrices.model *=  (translateTriangle * rotatedf);
-		MVP = VP * Matrices.model;
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(score);
-
-	}
-
-
-	if (level != 1 && level !=4){
-
-		Matrices.model = glm::mat4(1.0f);
-		glm::mat4 translateTriangle = glm::translate (glm::vec3(88.85,50.5, 0));
-		Matrices.model *=  (translateTriangle);
-		MVP = VP * Matrices.model;
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(score);
-
-
-	}
-
-	if(level != 5 && level != 6){
-
-		Matrices.model = glm::mat4(1.0f);
-		glm::mat4 translateRectangle = glm::translate (glm::vec3(90,49.65, 0));
-		glm::mat4 rotatede = glm::rotate((float)(M_PI/2), glm::vec3(0,0,1)); 
-		Matrices.model *=  (translateRectangle * rotatede);
-		MVP = VP * Matrices.model;
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(score);
-	}
-
-	if(level != 1 && level != 7 && level != 0){
-
-		Matrices.model = glm::mat4(1.0f);
-		glm::mat4 translateTriangle = glm::translate (glm::vec3(88.85,48.9, 0));
-		Matrices.model *=  (translateTriangle);
-		MVP = VP * Matrices.model;
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(score);
-
-
-
-	}
-	if(level != 1 && level != 3 && level !=2 && level != 7){
-
-		Matrices.model = glm::mat4(1.0f);
-		glm::mat4 translateRectangle = glm::translate (glm::vec3(87.7,49.65, 0));
-		glm::mat4 rotatec = glm::rotate((float)(M_PI/2), glm::vec3(0,0,1)); 
-		Matrices.model *=  (translateRectangle * rotatec);
-		MVP = VP * Matrices.model;
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(score);
-
-
-	}
-	
-	if(level != 1 && level != 4 && level != 7 ){
-
-		Matrices.model = glm::mat4(1.0f);
-		glm::mat4 translateTriangle = glm::translate (glm::vec3(88.85,47.25, 0));
-		Matrices.model *=  (translateTriangle);
-		MVP = VP * Matrices.model;
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(score);
-
-
-
-	}
-	if(level == 2 || level == 6 || level == 8 || level == 0){
-
-		Matrices.model = glm::mat4(1.0f);
-		glm::mat4 translateRectangle = glm::translate (glm::vec3(87.7,48.15, 0));
-		glm::mat4 rotatev = glm::rotate((float)(M_PI/2), glm::vec3(0,0,1)); 
-		Matrices.model *=  (translateRectangle * rotatev);
-		MVP = VP * Matrices.model;
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		draw3DObject(score);
-
-
-	}
-
-
-
-
-
-
-
 	//printf(", flag = %d \n ", flag);
-	Matrices.model = glm::mat4(1.0f);
-	MVP = VP * Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+	gpuPass(PASS_WORLD);
+	backend->setMVP(VP2D);
 	draw3DObject(circle); 	
 
 
 			
 	
+	gpuPass(PASS_HUD);
 	float k=0.2;
 	for (int i=0;i < 2*len;i++ ){
-		Matrices.model = glm::mat4(1.0f);
-		glm::mat4 translateTriangle = glm::translate (glm::vec3(4.5+i+k,49.5, 0));
-		Matrices.model *=  (translateTriangle);
-		MVP = VP * Matrices.model;
-		glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+		backend->setMVP(VP2D * affineTranslate(4.5+i+k, 49.5));
 		draw3DObject(bar[i]);
 		k +=0.2;
 	}
- 	Matrices.model = glm::mat4(1.0f);
-	glm::mat4 translateb = glm::translate (glm::vec3(0,45,0));
-	Matrices.model *=  (translateb);
-	MVP = VP * Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	draw3DObject(rectb);
-
-	Matrices.model = glm::mat4(1.0f);
-	glm::mat4 translates = glm::translate (glm::vec3(95,0,0));
-	Matrices.model *=  (translates);
-	MVP = VP * Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	draw3DObject(recs);
 
+	gpuPass(PASS_WORLD);
+	drawWalls();
 
-	Matrices.model = glm::mat4(1.0f);
-	
-	MVP = VP * Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	draw3DObject(rectb);	
-	
-	Matrices.model = glm::mat4(1.0f);
-	
-	MVP = VP * Matrices.model;
-	glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-	draw3DObject(recs);
-	
-
-	
+	DEBUG_FLUSH(VP2D);
+	viewsClip(0);
 }
 
 /* Initialise glfw window, I/O callbacks and the renderer to use */
 /* Nothing to Edit here */
-GLFWwindow* initGLFW (int width, int height)
+GLFWwindow* initGLFW (int width, int height, int debug_context, int visible)
 {
 	GLFWwindow* window; // window desciptor/handle
 
@@ -1526,18 +4926,37 @@ GLFWwindow* initGLFW (int width, int height)
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, debug_context ? GL_TRUE : GL_FALSE);
+	glfwWindowHint(GLFW_VISIBLE, visible ? GL_TRUE : GL_FALSE);
+#ifdef GLFW_COCOA_RETINA_FRAMEBUFFER
+	// Golden runs want the same pixels on every display
+	if (golden_dir)
+		glfwWindowHint(GLFW_COCOA_RETINA_FRAMEBUFFER, GL_FALSE);
+#endif
 
 	window = glfwCreateWindow(width, height, "MOVE ON", NULL, NULL);
 
+	// The software and null backends can still run without any GL, they just can't present
+	if (!window && backend != &gl_backend) {
+		glfwDefaultWindowHints();
+		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+		glfwWindowHint(GLFW_VISIBLE, visible ? GL_TRUE : GL_FALSE);
+		window = glfwCreateWindow(width, height, "MOVE ON", NULL, NULL);
+		if (window) {
+			cout << "No GL context, nothing will be presented" << endl;
+		}
+	}
+	else if (window) {
+		glfwMakeContextCurrent(window);
+		gl_available = gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
+		glfwSwapInterval( visible ? 1 : 0 );
+	}
+
 	if (!window) {
 		glfwTerminate();
 		exit(EXIT_FAILURE);
 	}
 
-	glfwMakeContextCurrent(window);
-	gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
-	glfwSwapInterval( 1 );
-
 	/* --- register callbacks with GLFW --- */
 
 	/* Register function to handle window resizes */
@@ -1549,6 +4968,9 @@ GLFWwindow* initGLFW (int width, int height)
 	/* Register function to handle window close */
 	glfwSetWindowCloseCallback(window, quit);
 
+	/* Redraw when the window is exposed even if nothing moved */
+	glfwSetWindowRefreshCallback(window, windowRefresh);
+
 	/* Register function to handle keyboard input */
 	glfwSetKeyCallback(window, keyboard);      // general keyboard input
 	glfwSetCharCallback(window, keyboardChar);  // simpler specific character handling
@@ -1567,8 +4989,8 @@ void initGL (GLFWwindow* window, int width, int height)
 	// Create the models
 //	createTriangle (); // Generate the VAO, VBOs, vertices data & copy into the array buffer
 	createRectangle ();
-	createball(10000,5,5,0,0.5);
-	createCircle (10000,5,5,0,3);
+	createCircleLods ();
+	applyQuality (quality);
 
 	float color[3];
 	color[0] = 1;
@@ -1582,28 +5004,52 @@ void initGL (GLFWwindow* window, int width, int height)
 	createrecs();
 	createrectb();
 	createrecp();
-	createsmall();
 	createrecball();
 	createscore();
-	// Create and compile our GLSL program from the shaders
-	programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
-	// Get a handle for our "MVP" uniform
-	Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
 
+	// Names used by --gl-debug output
+	nameObject(rectangle, "cannon");
+	for (i=0; i < 40; i++)
+		nameObject(bar[i], "power_bar");
+	nameObject(recs, "side_wall");
+	nameObject(rectb, "floor_wall");
+	nameObject(recp, "power_frame");
+	nameObject(recball, "ammo_frame");
+	nameObject(score, "level_digit");
+	createStaticNodes();
+
+	// Shaders, clear colour and depth state for the active backend
+	backend->init(window);
+
+	// Objects drawn from the atlas when it has a sprite for them
+	if (backend == &gl_backend && atlas_path)
+		spriteInit();
+	for (i=0; i < QUALITY_LEVELS; i++) {
+		useSprite(key_lod[i], "key", -1, -1, 1, 1);
+		useSprite(ex_lod[i], "exit", -1.7, -1.7, 1.7, 1.7);
+		animate(key_lod[i], MOTION_BOB, 0);
+		animate(ex_lod[i], MOTION_SPIN, 0);
+	}
+	useSprite(score, "segment", -0.65, -0.25, 0.65, 0.25);
+
+	// Bloom sources for --post
+	for (i=0; i < QUALITY_LEVELS; i++)
+		key_lod[i]->Glow = ex_lod[i]->Glow = small_lod[i]->Glow = 1;
+	if (post_enabled)
+		postInit();
+	if (light_enabled)
+		lightInit();
+	if (show_stats || post_enabled || golden_dir)
+		gpuInit();
+	trailInit();
+	particleInit();
+	tileInit();
+	hazardInit();
+	minimapInit();
+	if (overdraw_enabled)
+		overdrawInit();
 
 	reshapeWindow (window, width, height);
-
-	// Background color of the scene
-	glClearColor (0.2f, 0.2f, 0.2f, 0.2f); // R, G, B, A
-	glClearDepth (1.0f);
-
-	glEnable (GL_DEPTH_TEST);
-	glDepthFunc (GL_LEQUAL);
-
-	cout << "VENDOR: " << glGetString(GL_VENDOR) << endl;
-	cout << "RENDERER: " << glGetString(GL_RENDERER) << endl;
-	cout << "VERSION: " << glGetString(GL_VERSION) << endl;
-	cout << "GLSL: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << endl;
 }
 
 void createMap(){
@@ -1637,32 +5083,54 @@ void createMap(){
 	}
 
 	//n = 20;
+	invalidateStaticLayer();
+	invalidateMinimap();
 	s.clear();
+	for (size_t i=0; i < arr_s.size(); i++)
+		free3DObject(arr_s[i]);
 	arr_s.clear();
 	obst.clear();
+	for (size_t i=0; i < arr_obs.size(); i++)
+		free3DObject(arr_obs[i]);
 	arr_obs.clear();
+	obst_node.clear();
+	s_node.clear();
+	xformTruncate(static_nodes);
 	while (getline(file,line)&&y>=0 ){
 		int x=0;
 		while(x<line.length() && x <= 96 ){
 			switch(line[x]){
 				case'x':
 					obst.push_back(glm::vec3(float(x)+0.5,y-0.5,0.0f));
+					if (tile_gpu) {
+						tileAdd(obst.back().x, obst.back().y, TILE_BLOCK);
+						break;
+					}
 					arr_obs.push_back(createblock(cl));
+					nameObject(arr_obs.back(), "obstacle");
+					useSprite(arr_obs.back(), "block", -0.5, -0.5, 0.5, 0.5);
+					obst_node.push_back(xformNode(-1, affineTranslate(obst.back().x, obst.back().y)));
 					break;
 				case'k':
 					k_pos_x = x+0.5;
 					k_pos_y = y-0.5;
-					createkey();
 					pass = 0;
 					break;
 				case'e':
 					e_pos_x = x+0.5;
 					e_pos_y = y-0.5;
-					createexit();
 					break;
 				case 's':
 					s.push_back(glm::vec3(float(x)+0.5,y-0.5,0.0f));
+					if (tile_gpu) {
+						tileAdd(s.back().x, s.back().y, TILE_SPIKE);
+						break;
+					}
 					arr_s.push_back(createspok(cll));
+					nameObject(arr_s.back(), "spike");
+					animate(arr_s.back(), MOTION_PULSE_SPIN, 0.7*s.back().x + 1.3*s.back().y);
+					useSprite(arr_s.back(), "spike", -0.5, -0.5, 0.5, 0.5);
+					s_node.push_back(xformNode(-1, affineTranslate(s.back().x, s.back().y)));
 					break;
 
 				default:
@@ -1672,6 +5140,10 @@ void createMap(){
 		}
 		y--;
 	}
+	tileUpload(cl, cll);
+	hazardUpload();
+	tileLodBuild(cl);
+	lightTiles();
 }
 /*void checkcollision(){
 
@@ -1685,47 +5157,652 @@ void createMap(){
 }*/
 	
 
+/**************************
+ * Damage tracking        *
+ **************************/
+
+/* What ends up on screen; two equal snapshots in a row mean the scene has come to rest */
+struct SceneState {
+	double x_proj, y_proj, v, x_p1, flag;
+	float rotation, box[4];
+	int level, pass, n, prick, quality, wid, hgt;
+};
+
+SceneState scene_last;
+int scene_moving = 1;		// last drawn frame differed from the one before it
+int idle_skip = 1;		// wait for events instead of redrawing a still scene
+long frames_skipped = 0;
+
+#define ANIM_IDLE_FPS 30	// redraws a second of a still scene with moving hazards in view
+double anim_drawn = -1;	// when the last frame was drawn
+
+SceneState sceneState ()
+{
+	SceneState st;
+	st.x_proj = x_proj; st.y_proj = y_proj; st.v = v; st.x_p1 = x_p1; st.flag = flag;
+	st.rotation = rectangle_rotation;
+	st.box[0] = x_1; st.box[1] = x_2; st.box[2] = y_1; st.box[3] = y_2;
+	st.level = level; st.pass = pass; st.n = n; st.prick = prick;
+	st.quality = quality; st.wid = wid; st.hgt = hgt;
+	return st;
+}
+
+/* Positions within 1/500 of a unit are the same pixel at any zoom the game allows */
+int sceneSame (const SceneState &a, const SceneState &b)
+{
+	const double eps = 0.002;
+	return fabs(a.x_proj - b.x_proj) < eps && fabs(a.y_proj - b.y_proj) < eps &&
+		fabs(a.v - b.v) < eps && fabs(a.x_p1 - b.x_p1) < eps && a.flag == b.flag &&
+		fabs(a.rotation - b.rotation) < eps && !memcmp(a.box, b.box, sizeof(a.box)) &&
+		a.level == b.level && a.pass == b.pass && a.n == b.n && a.prick == b.prick &&
+		a.quality == b.quality && a.wid == b.wid && a.hgt == b.hgt;
+}
+
+/* Is anything the vertex shader moves inside the camera box? */
+int animationInView ()
+{
+	if (!animation_enabled)
+		return 0;
+	// The second view follows the exit around
+	if (split_view && e_pos_x > 0)
+		return 1;
+	const double reach = 1.7;	// half the exit sprite, the largest of them
+	// The key only until it is picked up, then just the exit
+	double pos[2][2] = {{k_pos_x, k_pos_y}, {e_pos_x, e_pos_y}};
+	for (int i = pass; i < 2; i++) {
+		if (pos[i][0] > x_1 - reach && pos[i][0] < x_2 + reach && pos[i][1] > y_1 - reach && pos[i][1] < y_2 + reach)
+			return 1;
+	}
+	for (size_t i=0; i < s.size(); i++) {
+		if (s[i].x > x_1 - reach && s[i].x < x_2 + reach && s[i].y > y_1 - reach && s[i].y < y_2 + reach)
+			return 1;
+	}
+	return 0;
+}
+
+/* Seconds until moving hazards in view want the next frame, or the
+   usual idle wait when nothing moves */
+double animationWait ()
+{
+	if (!animationInView())
+		return 0.25;
+	return max(0.0, anim_drawn + 1.0/ANIM_IDLE_FPS - glfwGetTime());
+}
+
+/* Record the state the frame just drawn shows */
+void damageCommit ()
+{
+	anim_drawn = glfwGetTime();
+	SceneState st = sceneState();
+	scene_moving = !sceneSame(st, scene_last);
+	scene_last = st;
+	damage_pending = 0;
+}
+
+/* Does the next frame need drawing at all? */
+int frameDamaged ()
+{
+	if (!idle_skip || damage_pending || scene_moving || particlesLive())
+		return 1;
+	// Moving hazards need new frames, but not at the full frame rate
+	if (animationWait() == 0)
+		return 1;
+	// Held W/S/A/D and aiming with the mouse move the cannon inside draw()
+	if (keyboard_movement || power_movement || mouse_movement)
+		return 1;
+	// Arrow key and drag pans, zoom and resizes happen outside draw()
+	return !sceneSame(sceneState(), scene_last);
+}
+
+
+/**************************
+ * Golden images          *
+ **************************/
+
+/* --golden DIR plays every level file (0.txt, 1.txt, ...) in a hidden
+   window, driving the input callbacks from a script, and at each snap
+   compares the finished picture, box filtered down to GOLDEN_W wide, with
+   DIR/<renderer>_<level>_<frame>.ppm.
+   A pixel differs when a channel is off by more than --golden-tolerance;
+   a snap fails when over GOLDEN_BAD_PIXELS of them differ, and is then
+   written next to the golden as .fail.ppm, as is a snap whose golden is
+   unreadable or of another size. Missing goldens are recorded, with their
+   draw(), frame and GPU ms in a .time file; every run logs its own times
+   beside those in DIR/<renderer>.log.
+
+   The script is DIR/script.txt, or golden_script when there is none. Each
+   line is "frame command", frames counted from the start of the level:
+   press KEY, release KEY (W A S D R SPACE UP DOWN LEFT RIGHT MOUSE),
+   cursor X Y, snap, end */
+
+#define GOLDEN_BAD_PIXELS 0.001	// fraction of pixels allowed to differ
+#define GOLDEN_W 240	// width goldens are kept at, a box filtered copy of the picture
+
+enum { GOLDEN_PRESS, GOLDEN_RELEASE, GOLDEN_CURSOR, GOLDEN_SNAP, GOLDEN_END };
+
+struct GoldenStep {
+	int frame, op, key;
+	double x, y;
+};
+
+struct GoldenKey {
+	const char *name;
+	int key;	// -1 for the left mouse button
+};
+
+GoldenKey golden_keys[] = {
+	{"W", GLFW_KEY_W}, {"A", GLFW_KEY_A}, {"S", GLFW_KEY_S}, {"D", GLFW_KEY_D}, {"R", GLFW_KEY_R},
+	{"SPACE", GLFW_KEY_SPACE}, {"UP", GLFW_KEY_UP}, {"DOWN", GLFW_KEY_DOWN},
+	{"LEFT", GLFW_KEY_LEFT}, {"RIGHT", GLFW_KEY_RIGHT}, {"MOUSE", -1}
+};
+
+// Aim, charge, fire, and look at the shot on its way
+const char *golden_script =
+	"0 cursor 600 200\n"
+	"0 snap\n"
+	"1 press D\n"
+	"20 release D\n"
+	"21 press SPACE\n"
+	"22 release SPACE\n"
+	"40 snap\n"
+	"90 snap\n"
+	"91 end\n";
+
+int golden_tolerance = 2;	// --golden-tolerance, per channel
+vector<GoldenStep> golden_steps;
+int golden_level = -1, golden_frame = 0, golden_next = 0;
+int golden_snaps = 0, golden_failures = 0;
+double golden_cursor_x = 0, golden_cursor_y = 0;
+vector<unsigned char> golden_pixels;
+int golden_w = 0, golden_h = 0;
+FILE *golden_log = NULL;
+
+/* Read a binary PPM into RGB rows, bottom row first */
+int readPPM (const char *path, int *w, int *h, vector<unsigned char> &rgb)
+{
+	ifstream in(path, ios::in | ios::binary);
+	string magic;
+	int maxval;
+	if (!(in >> magic >> *w >> *h >> maxval) || magic != "P6" || maxval != 255 || *w <= 0 || *h <= 0)
+		return 0;
+	in.get();
+	rgb.resize(3 * *w * *h);
+	for (int y = *h-1; y >= 0; y--)
+		in.read((char*)&rgb[3*y * *w], 3 * *w);
+	return !!in;
+}
+
+int goldenParse (istream &in)
+{
+	string line;
+	while (getline(in, line)) {
+		istringstream fields(line);
+		GoldenStep step = {0, 0, 0, 0, 0};
+		string command;
+		if (line.empty() || line[0] == '#' || !(fields >> step.frame >> command))
+			continue;
+		if (command == "press" || command == "release") {
+			string name;
+			fields >> name;
+			step.op = command == "press" ? GOLDEN_PRESS : GOLDEN_RELEASE;
+			step.key = 0;
+			for (size_t i=0; i < sizeof(golden_keys)/sizeof(golden_keys[0]); i++) {
+				if (name == golden_keys[i].name)
+					step.key = golden_keys[i].key;
+			}
+			if (step.key == 0) {
+				fprintf(stderr, "Error: unknown key %s in golden script\n", name.c_str());
+				return 0;
+			}
+		}
+		else if (command == "cursor") {
+			step.op = GOLDEN_CURSOR;
+			fields >> step.x >> step.y;
+		}
+		else if (command == "snap")
+			step.op = GOLDEN_SNAP;
+		else if (command == "end")
+			step.op = GOLDEN_END;
+		else {
+			fprintf(stderr, "Error: unknown command %s in golden script\n", command.c_str());
+			return 0;
+		}
+		golden_steps.push_back(step);
+	}
+	return !golden_steps.empty();
+}
+
+/* Start the next level that has a file, or return 0 after the last one */
+int goldenNextLevel ()
+{
+	golden_level++;
+	char path[32];
+	sprintf(path, "%d.txt", golden_level);
+	if (!ifstream(path))
+		return 0;
+	level = golden_level;
+	n = 20;
+	pass = 0;
+	flag = 0;
+	inc = 0;
+	createMap();
+	golden_frame = 0;
+	golden_next = 0;
+	return 1;
+}
+
+/* Pin everything that depends on wall clock time, load the script and
+   open the log; returns 0 if there is nothing to run */
+int goldenSetup ()
+{
+	if (backend == &null_backend) {
+		fprintf(stderr, "Error: the null renderer draws no pixels to compare\n");
+		return 0;
+	}
+	quality_pinned = 1;
+	idle_skip = 0;
+	particle_count = 0;	// particle lifetimes follow the clock
+	post_budget = 1e9;	// keep the post level fixed
+
+	string script = string(golden_dir) + "/script.txt";
+	ifstream file(script.c_str());
+	istringstream builtin(golden_script);
+	if (!goldenParse(file.is_open() ? (istream&)file : (istream&)builtin))
+		return 0;
+
+	string log = string(golden_dir) + "/" + backend->name + ".log";
+	golden_log = fopen(log.c_str(), "w");
+	if (!golden_log) {
+		fprintf(stderr, "Error: could not write %s\n", log.c_str());
+		return 0;
+	}
+	fprintf(golden_log, "# snap result differing_pixels draw_ms frame_ms gpu_ms golden_draw_ms golden_frame_ms golden_gpu_ms\n");
+	return 1;
+}
+
+int goldenSnapDue ()
+{
+	for (size_t i = golden_next; i < golden_steps.size() && golden_steps[i].frame == golden_frame; i++) {
+		if (golden_steps[i].op == GOLDEN_SNAP)
+			return 1;
+	}
+	return 0;
+}
+
+/* Feed this frame's scripted input through the normal callbacks. Snaps
+   are left in place for goldenFrame, which moves the script on */
+void goldenInput (GLFWwindow *window)
+{
+	if (!golden_dir)
+		return;
+	for (size_t i = golden_next; i < golden_steps.size() && golden_steps[i].frame == golden_frame; i++) {
+		const GoldenStep &step = golden_steps[i];
+		int action = step.op == GOLDEN_PRESS ? GLFW_PRESS : GLFW_RELEASE;
+		if (step.op == GOLDEN_CURSOR) {
+			golden_cursor_x = step.x;
+			golden_cursor_y = step.y;
+		}
+		else if (step.op == GOLDEN_SNAP)
+			continue;
+		else if (step.op == GOLDEN_END)
+			break;
+		else if (step.key < 0)
+			mouseButton(window, GLFW_MOUSE_BUTTON_LEFT, action, 0);
+		else
+			keyboard(window, step.key, 0, action, 0);
+	}
+	// The real pointer is wherever the desktop left it
+	x_cur = golden_cursor_x;
+	y_cur = golden_cursor_y;
+}
+
+/* On the GL backend the picture has to be read before the buffers swap,
+   and from the offscreen target when rendering below window resolution */
+void goldenReadBack ()
+{
+	if (!golden_dir || backend != &gl_backend || !goldenSnapDue())
+		return;
+	GLuint target = sceneTarget(&golden_w, &golden_h);
+	golden_pixels.resize(3*golden_w*golden_h);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, target);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, golden_w, golden_h, GL_RGB, GL_UNSIGNED_BYTE, &golden_pixels[0]);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+/* Count the pixels of the last snap that differ from the golden, -1 if
+   there is no golden of the same size */
+long goldenDiff (const char *path)
+{
+	int w, h;
+	vector<unsigned char> expected;
+	if (!readPPM(path, &w, &h, expected) || w != golden_w || h != golden_h)
+		return -1;
+	long bad = 0;
+	for (long i=0; i < (long)w*h; i++) {
+		for (int k=0; k < 3; k++) {
+			if (abs(golden_pixels[3*i+k] - expected[3*i+k]) > golden_tolerance) {
+				bad++;
+				break;
+			}
+		}
+	}
+	return bad;
+}
+
+/* Average the snap down to GOLDEN_W wide, so the goldens stay small and
+   a framebuffer scaled for the display gives the same size */
+void goldenShrink ()
+{
+	int f = max(1, golden_w / GOLDEN_W), w = golden_w / f, h = golden_h / f;
+	vector<unsigned char> small(3*w*h);
+	for (int y=0; y < h; y++) {
+		for (int x=0; x < w; x++) {
+			for (int k=0; k < 3; k++) {
+				int sum = 0;
+				for (int j=0; j < f; j++) {
+					for (int i=0; i < f; i++)
+						sum += golden_pixels[3*((y*f + j)*golden_w + x*f + i) + k];
+				}
+				small[3*(y*w + x) + k] = (sum + f*f/2) / (f*f);
+			}
+		}
+	}
+	golden_pixels.swap(small);
+	golden_w = w;
+	golden_h = h;
+}
+
+void goldenSnap (double draw_time, double frame_time)
+{
+	if (backend == &soft_backend) {
+		golden_w = soft_w;
+		golden_h = soft_h;
+		softPixels(golden_pixels);
+	}
+	goldenShrink();
+	double gpu_ms = gpu_enabled ? gpuTotalTime() : -1;
+	char name[64];
+	sprintf(name, "%s_%d_%04d", backend->name, golden_level, golden_frame);
+	string base = string(golden_dir) + "/" + name;
+	string golden = base + ".ppm", timing = base + ".time";
+
+	const char *result;
+	long bad = goldenDiff(golden.c_str());
+	double recorded[3] = {-1, -1, -1};
+	if (bad < 0 && !ifstream(golden.c_str())) {
+		// First run: this picture becomes the golden
+		result = "new";
+		writePPM(golden.c_str(), golden_w, golden_h, golden_pixels);
+		FILE *f = fopen(timing.c_str(), "w");
+		if (f) {
+			fprintf(f, "%.3f %.3f %.3f\n", 1000*draw_time, 1000*frame_time, gpu_ms);
+			fclose(f);
+		}
+		bad = 0;
+	}
+	else {
+		ifstream f(timing.c_str());
+		f >> recorded[0] >> recorded[1] >> recorded[2];
+		// A golden we cannot compare against counts as every pixel differing
+		if (bad < 0)
+			bad = (long)golden_w*golden_h;
+		if (bad > GOLDEN_BAD_PIXELS*golden_w*golden_h) {
+			result = "FAIL";
+			golden_failures++;
+			writePPM((base + ".fail.ppm").c_str(), golden_w, golden_h, golden_pixels);
+		}
+		else
+			result = "pass";
+	}
+	golden_snaps++;
+	printf("golden %s: %s, %ld pixels differ, draw() %.3f ms, frame %.3f ms, gpu %.3f ms\n",
+			name, result, bad, 1000*draw_time, 1000*frame_time, gpu_ms);
+	fprintf(golden_log, "%s %s %ld %.3f %.3f %.3f %.3f %.3f %.3f\n", name, result, bad,
+			1000*draw_time, 1000*frame_time, gpu_ms, recorded[0], recorded[1], recorded[2]);
+}
+
+/* After a frame is presented: take the snaps due, then move the script on,
+   closing the window once every level has run */
+void goldenFrame (GLFWwindow *window, double draw_time, double frame_time)
+{
+	if (!golden_dir)
+		return;
+	// Frames are timed one at a time, each GPU time covers exactly this frame
+	gpuDrain();
+	if (goldenSnapDue())
+		goldenSnap(draw_time, frame_time);
+	gpuReset();
+
+	while ((size_t)golden_next < golden_steps.size() && golden_steps[golden_next].frame == golden_frame) {
+		if (golden_steps[golden_next].op == GOLDEN_END)
+			golden_next = golden_steps.size();
+		else
+			golden_next++;
+	}
+	golden_frame++;
+	if ((size_t)golden_next < golden_steps.size())
+		return;
+	if (goldenNextLevel())
+		return;
+	printf("golden: %d snaps, %d failed\n", golden_snaps, golden_failures);
+	fclose(golden_log);
+	glfwSetWindowShouldClose(window, 1);
+}
+
 int main (int argc, char** argv)
 {
 	int width = 960;
 	int height = 540;
+	const char *capture_path = NULL, *debug_path = NULL;
+	int capture_frames = 0;
+
+	for (int i=1; i < argc; i++) {
+		if (!strcmp(argv[i], "--fps") && i+1 < argc) {
+			frame_budget = 1.0/max(1.0, atof(argv[++i]));
+		}
+		else if (!strcmp(argv[i], "--quality") && i+1 < argc) {
+			quality = min(max(atoi(argv[++i]), 0), QUALITY_LEVELS-1);
+			quality_pinned = 1;
+		}
+		else if (!strcmp(argv[i], "--renderer") && i+1 < argc) {
+			i++;
+			if (!strcmp(argv[i], "soft"))
+				backend = &soft_backend;
+			else if (!strcmp(argv[i], "null"))
+				backend = &null_backend;
+			else if (strcmp(argv[i], "gl"))
+				fprintf(stderr, "Unknown renderer %s, using gl\n", argv[i]);
+		}
+		else if (!strcmp(argv[i], "--threads") && i+1 < argc) {
+			soft_threads = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--stats")) {
+			show_stats = 1;
+		}
+		else if (!strcmp(argv[i], "--frames") && i+1 < argc) {
+			frame_limit = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--no-layer-cache")) {
+			layer_enabled = 0;
+		}
+		else if (!strcmp(argv[i], "--no-idle-skip")) {
+			idle_skip = 0;
+		}
+		else if (!strcmp(argv[i], "--no-atlas")) {
+			atlas_path = NULL;
+		}
+		else if (!strcmp(argv[i], "--no-trail")) {
+			trail_enabled = 0;
+		}
+		else if (!strcmp(argv[i], "--overdraw")) {
+			overdraw_enabled = 1;
+		}
+		else if (!strcmp(argv[i], "--no-animation")) {
+			animation_enabled = 0;
+		}
+		else if (!strcmp(argv[i], "--gpu-tiles")) {
+			tile_gpu = 1;
+		}
+		else if (!strcmp(argv[i], "--lod-pixels") && i+1 < argc) {
+			lod_pixels = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--split-view")) {
+			split_view = 1;
+		}
+		else if (!strcmp(argv[i], "--no-minimap")) {
+			minimap_enabled = 0;
+		}
+		else if (!strcmp(argv[i], "--particles") && i+1 < argc) {
+			particle_count = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--lights")) {
+			light_enabled = 1;
+		}
+		else if (!strcmp(argv[i], "--lightmap-div") && i+1 < argc) {
+			light_div = max(1, atoi(argv[++i]));
+		}
+		else if (!strcmp(argv[i], "--post")) {
+			post_enabled = 1;
+		}
+		else if (!strcmp(argv[i], "--post-budget") && i+1 < argc) {
+			post_budget = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--gl-debug") && i+1 < argc) {
+			debug_path = argv[++i];
+		}
+		else if (!strcmp(argv[i], "--golden") && i+1 < argc) {
+			golden_dir = argv[++i];
+		}
+		else if (!strcmp(argv[i], "--golden-tolerance") && i+1 < argc) {
+			golden_tolerance = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--capture") && i+2 < argc) {
+			capture_path = argv[++i];
+			capture_frames = atoi(argv[++i]);
+		}
+	}
+
+	// Golden runs are offscreen and must not wait for vsync
+	GLFWwindow* window = initGLFW(width, height, debug_path != NULL, golden_dir == NULL);
+
+	if (debug_path && gl_available)
+		debugInstall(debug_path);
+
+	// Benchmarks and captures count drawn frames, so never sit idle there
+	if (frame_limit || capture_path)
+		idle_skip = 0;
+	if (golden_dir && !goldenSetup())
+		exit(EXIT_FAILURE);
+
+	// Only the GL backend has a vertex shader to move things in
+	if (backend != &gl_backend)
+		animation_enabled = 0;
+
+	if (tile_gpu && backend != &gl_backend) {
+		fprintf(stderr, "GPU tile culling needs the gl renderer, ignoring --gpu-tiles\n");
+		tile_gpu = 0;
+	}
+
+	// Views are placed in the vertex shaders. Tiles are culled against the
+	// camera and the lightmap is lit in its screen space, so neither can
+	// follow the second view
+	if (split_view && backend != &gl_backend) {
+		fprintf(stderr, "Split view needs the gl renderer, ignoring --split-view\n");
+		split_view = 0;
+	}
+	if (split_view && (tile_gpu || light_enabled)) {
+		fprintf(stderr, "Split view draws tiles as meshes and without lights\n");
+		tile_gpu = light_enabled = 0;
+	}
+
+	// The heatmap counts plain object draws, so drop everything drawn another way
+	if (overdraw_enabled && backend != &gl_backend) {
+		fprintf(stderr, "The overdraw heatmap needs the gl renderer, ignoring --overdraw\n");
+		overdraw_enabled = 0;
+	}
+	if (overdraw_enabled) {
+		layer_enabled = trail_enabled = light_enabled = post_enabled = minimap_enabled = 0;
+		particle_count = 0;
+		atlas_path = NULL;
+	}
 
-	GLFWwindow* window = initGLFW(width, height);
+	// Hook GL before initGL so shaders and meshes are part of the stream
+	if (capture_path && gl_available) {
+		int fbwidth, fbheight;
+		glfwGetFramebufferSize(window, &fbwidth, &fbheight);
+		captureStart(capture_path, capture_frames, fbwidth, fbheight);
+	}
 
 	initGL (window, width, height);
 
 	double last_update_time = glfwGetTime(), current_time;
 	n = 20;
-	createMap();
+	if (!golden_dir)
+		createMap();
+	else if (!goldenNextLevel()) {
+		fprintf(stderr, "Error: no level files to play for --golden\n");
+		exit(EXIT_FAILURE);
+	}
 
 	/* Draw in loop */
-	while (!glfwWindowShouldClose(window)) {
+	while (!glfwWindowShouldClose(window) && (frame_limit == 0 || frames_drawn < frame_limit)) {
 
 		// OpenGL Draw commands
 		glfwGetCursorPos(window, &x_cur, &y_cur);
-		draw();
-		if(inc == 1){
-			if(level == 0){
-				level = 1;
+		goldenInput(window);
+		// Golden runs animate on frame numbers so every run matches
+		anim_time = golden_dir ? golden_frame/60.0 : glfwGetTime();
+		if (frameDamaged()) {
+			captureFrame();
+			double frame_start = glfwGetTime();
+			backend->beginFrame(window);
+			gpuFrameBegin();
+			double draw_start = glfwGetTime();
+			draw();
+			double draw_time = glfwGetTime() - draw_start;
+			if(inc == 1){
+				if(level == 0){
+					level = 1;
+				}
+				createMap();
+				inc = 0;
+				flag = 0;
 			}
-			createMap();
-			inc = 0;
-			flag = 0;
-		}
-		if(n<=0){
+			if(n<=0){
 
-			level = 0;
-			n = 20;
-			createMap();
-
-		}
+				level = 0;
+				n = 20;
+				createMap();
 
+			}
 
-		// Swap Frame Buffer in double buffering
-		glfwSwapBuffers(window);
 
-		// Poll for Keyboard and mouse events
-		glfwPollEvents();
+			// Lighting, then bloom and vignette over the finished scene
+			overdrawResolve();
+			lightProcess();
+			postProcess();
+			minimapDraw();
+			gpuFrameEnd();
+			goldenReadBack();
+
+			// Present, and swap Frame Buffer in double buffering
+			backend->endFrame(window);
+			double frame_time = glfwGetTime() - frame_start;
+			governorUpdate(frame_time);
+			statsUpdate(draw_time, frame_time);
+			goldenFrame(window, draw_time, frame_time);
+			damageCommit();
+
+			// Poll for Keyboard and mouse events
+			glfwPollEvents();
+		}
+		else {
+			// Same picture as last frame: sleep until input, or until the
+			// moving hazards are due again, instead of redrawing it
+			frames_skipped++;
+			glfwWaitEventsTimeout(max(0.001, animationWait()));
+		}
 		//updateRectangle();
 		glfwGetWindowSize(window, &wid, &hgt);
   	    glfwSetScrollCallback(window, scroll_callback);
@@ -1735,9 +5812,19 @@ int main (int argc, char** argv)
 		if ((current_time - last_update_time) >= 1) { // atleast 0.5s elapsed since last frame
 			// do something every 0.5 seconds ..
 			last_update_time = current_time;
+			statsReport();
+			postReport();
+			gpuReport();
+			debugFlush();
 		}
 	}
 
+	if (frames_drawn > 0) {
+		printf("%s: %ld frames, avg draw() %.3f ms, avg frame %.3f ms\n", backend->name, frames_drawn, 1000*total_draw_time/frames_drawn, 1000*total_frame_time/frames_drawn);
+	}
+	if (frames_skipped > 0) {
+		printf("skipped %ld idle frames\n", frames_skipped);
+	}
 	glfwTerminate();
-	exit(EXIT_SUCCESS);
+	exit(golden_failures ? EXIT_FAILURE : EXIT_SUCCESS);
 }
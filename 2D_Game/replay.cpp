@@ -0,0 +1,379 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <map>
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include "glcapture.h"
+
+/* Plays back a stream written by sample2D --capture as fast as the driver
+   allows. Setup commands run once, the captured frames are looped and
+   timed with glFinish, so only rendering cost is measured */
+
+using namespace std;
+
+vector<unsigned char> stream;
+size_t pos;
+
+// Names the capturing driver returned, mapped to the ones we got
+map<GLuint, GLuint> shaders, programs, vertex_arrays, buffers, textures, framebuffers, renderbuffers, feedbacks;
+map< pair<GLuint, GLint>, GLint > locations;
+GLuint current_program = 0;	// as recorded
+
+typedef void (APIENTRYP GenNamesProc)(GLsizei, GLuint*);
+typedef void (APIENTRYP DeleteNamesProc)(GLsizei, const GLuint*);
+
+// Objects generated by the looped frames, deleted again after every loop
+struct FrameName {
+	map<GLuint, GLuint> *names;
+	DeleteNamesProc del;
+	GLuint recorded;
+};
+vector<FrameName> frame_names;
+int in_frames = 0;
+
+unsigned int rdU32 ()
+{
+	unsigned int v;
+	memcpy(&v, &stream[pos], 4);
+	pos += 4;
+	return v;
+}
+
+GLint rdI32 ()
+{
+	return (GLint)rdU32();
+}
+
+float rdF32 ()
+{
+	float v;
+	memcpy(&v, &stream[pos], 4);
+	pos += 4;
+	return v;
+}
+
+unsigned long long rdU64 ()
+{
+	unsigned long long v;
+	memcpy(&v, &stream[pos], 8);
+	pos += 8;
+	return v;
+}
+
+/* Inline payload, NULL if the call was given a NULL pointer */
+const void* rdBytes (unsigned int *size=NULL)
+{
+	unsigned int n = rdU32();
+	const void *data = n ? &stream[pos] : NULL;
+	pos += n;
+	if (size)
+		*size = n;
+	return data;
+}
+
+GLuint mapName (map<GLuint, GLuint> &names, GLuint recorded)
+{
+	if (recorded == 0)
+		return 0;
+	map<GLuint, GLuint>::iterator it = names.find(recorded);
+	return it == names.end() ? recorded : it->second;
+}
+
+GLint mapLocation (GLint recorded)
+{
+	map< pair<GLuint, GLint>, GLint >::iterator it = locations.find(make_pair(current_program, recorded));
+	return it == locations.end() ? recorded : it->second;
+}
+
+/* A recorded name handed out again was deleted in between, so drop the
+   object we made for it before mapping the new one */
+void genNames (map<GLuint, GLuint> &names, GenNamesProc gen, DeleteNamesProc del)
+{
+	GLsizei n = rdU32();
+	vector<GLuint> fresh(n);
+	gen(n, &fresh[0]);
+	for (int i=0; i < n; i++) {
+		GLuint recorded = rdU32();
+		map<GLuint, GLuint>::iterator it = names.find(recorded);
+		if (it != names.end())
+			del(1, &it->second);
+		names[recorded] = fresh[i];
+		if (in_frames) {
+			FrameName fn = {&names, del, recorded};
+			frame_names.push_back(fn);
+		}
+	}
+}
+
+/* Delete what the frames generated so the next loop starts from setup */
+void releaseFrameNames ()
+{
+	for (size_t i=0; i < frame_names.size(); i++) {
+		FrameName &fn = frame_names[i];
+		map<GLuint, GLuint>::iterator it = fn.names->find(fn.recorded);
+		if (it == fn.names->end())
+			continue;
+		fn.del(1, &it->second);
+		fn.names->erase(it);
+	}
+	frame_names.clear();
+}
+
+/* Execute one command, returns its opcode */
+int execute ()
+{
+	int op = stream[pos++];
+	switch (op) {
+		case CAP_END:
+		case CAP_FRAME:
+			break;
+
+		case CAP_CLEAR: glClear(rdU32()); break;
+		case CAP_CLEAR_COLOR: { float r = rdF32(), g = rdF32(), b = rdF32(), a = rdF32(); glClearColor(r, g, b, a); break; }
+		case CAP_CLEAR_DEPTH: glClearDepth(rdF32()); break;
+		case CAP_ENABLE: glEnable(rdU32()); break;
+		case CAP_DISABLE: glDisable(rdU32()); break;
+		case CAP_DEPTH_FUNC: glDepthFunc(rdU32()); break;
+		case CAP_BLEND_FUNC: { GLenum s = rdU32(), d = rdU32(); glBlendFunc(s, d); break; }
+		case CAP_VIEWPORT: { GLint x = rdI32(), y = rdI32(), w = rdI32(), h = rdI32(); glViewport(x, y, w, h); break; }
+		case CAP_POLYGON_MODE: { GLenum face = rdU32(), mode = rdU32(); glPolygonMode(face, mode); break; }
+		case CAP_PIXEL_STOREI: { GLenum pname = rdU32(); glPixelStorei(pname, rdI32()); break; }
+
+		case CAP_CREATE_SHADER: { GLenum type = rdU32(); shaders[rdU32()] = glCreateShader(type); break; }
+		case CAP_SHADER_SOURCE: {
+			GLuint shader = mapName(shaders, rdU32());
+			unsigned int size;
+			const GLchar *source = (const GLchar*)rdBytes(&size);
+			GLint length = size;
+			glShaderSource(shader, 1, &source, &length);
+			break;
+		}
+		case CAP_COMPILE_SHADER: glCompileShader(mapName(shaders, rdU32())); break;
+		case CAP_DELETE_SHADER: glDeleteShader(mapName(shaders, rdU32())); break;
+		case CAP_CREATE_PROGRAM: programs[rdU32()] = glCreateProgram(); break;
+		case CAP_ATTACH_SHADER: { GLuint program = mapName(programs, rdU32()); glAttachShader(program, mapName(shaders, rdU32())); break; }
+		case CAP_LINK_PROGRAM: glLinkProgram(mapName(programs, rdU32())); break;
+		case CAP_USE_PROGRAM: current_program = rdU32(); glUseProgram(mapName(programs, current_program)); break;
+		case CAP_GET_UNIFORM_LOCATION: {
+			GLuint program = rdU32();
+			unsigned int size;
+			const char *name = (const char*)rdBytes(&size);
+			string uniform(name, size);
+			GLint recorded = rdI32();
+			locations[make_pair(program, recorded)] = glGetUniformLocation(mapName(programs, program), uniform.c_str());
+			break;
+		}
+		case CAP_UNIFORM_MATRIX4FV: {
+			GLint location = mapLocation(rdI32());
+			GLsizei count = rdU32();
+			GLboolean transpose = rdU32();
+			glUniformMatrix4fv(location, count, transpose, (const GLfloat*)rdBytes());
+			break;
+		}
+		case CAP_UNIFORM1I: { GLint location = mapLocation(rdI32()); glUniform1i(location, rdI32()); break; }
+		case CAP_UNIFORM1F: { GLint location = mapLocation(rdI32()); glUniform1f(location, rdF32()); break; }
+		case CAP_UNIFORM2F: { GLint location = mapLocation(rdI32()); float x = rdF32(), y = rdF32(); glUniform2f(location, x, y); break; }
+		case CAP_UNIFORM4F: { GLint location = mapLocation(rdI32()); float x = rdF32(), y = rdF32(), z = rdF32(), w = rdF32(); glUniform4f(location, x, y, z, w); break; }
+		case CAP_UNIFORM4FV: {
+			GLint location = mapLocation(rdI32());
+			GLsizei count = rdU32();
+			glUniform4fv(location, count, (const GLfloat*)rdBytes());
+			break;
+		}
+
+		case CAP_GEN_VERTEX_ARRAYS: genNames(vertex_arrays, glGenVertexArrays, glDeleteVertexArrays); break;
+		case CAP_BIND_VERTEX_ARRAY: glBindVertexArray(mapName(vertex_arrays, rdU32())); break;
+		case CAP_GEN_BUFFERS: genNames(buffers, glGenBuffers, glDeleteBuffers); break;
+		case CAP_BIND_BUFFER: { GLenum target = rdU32(); glBindBuffer(target, mapName(buffers, rdU32())); break; }
+		case CAP_BUFFER_DATA: {
+			GLenum target = rdU32();
+			GLsizeiptr size = rdU32();
+			const void *data = rdBytes();
+			glBufferData(target, size, data, rdU32());
+			break;
+		}
+		case CAP_BUFFER_SUB_DATA: {
+			GLenum target = rdU32();
+			GLintptr offset = rdU64();
+			unsigned int size;
+			const void *data = rdBytes(&size);
+			glBufferSubData(target, offset, size, data);
+			break;
+		}
+		case CAP_VERTEX_ATTRIB_POINTER: {
+			GLuint index = rdU32();
+			GLint size = rdI32();
+			GLenum type = rdU32();
+			GLboolean normalized = rdU32();
+			GLsizei stride = rdU32();
+			glVertexAttribPointer(index, size, type, normalized, stride, (const void*)(size_t)rdU64());
+			break;
+		}
+		case CAP_ENABLE_VERTEX_ATTRIB_ARRAY: glEnableVertexAttribArray(rdU32()); break;
+		case CAP_DISABLE_VERTEX_ATTRIB_ARRAY: glDisableVertexAttribArray(rdU32()); break;
+		case CAP_VERTEX_ATTRIB_DIVISOR: { GLuint index = rdU32(); glVertexAttribDivisor(index, rdU32()); break; }
+		case CAP_DRAW_ARRAYS: { GLenum mode = rdU32(); GLint first = rdI32(); glDrawArrays(mode, first, rdI32()); break; }
+		case CAP_DRAW_ARRAYS_INSTANCED: { GLenum mode = rdU32(); GLint first = rdI32(), count = rdI32(); glDrawArraysInstanced(mode, first, count, rdI32()); break; }
+
+		case CAP_GEN_TEXTURES: genNames(textures, glGenTextures, glDeleteTextures); break;
+		case CAP_BIND_TEXTURE: { GLenum target = rdU32(); glBindTexture(target, mapName(textures, rdU32())); break; }
+		case CAP_ACTIVE_TEXTURE: glActiveTexture(rdU32()); break;
+		case CAP_TEX_PARAMETERI: { GLenum target = rdU32(), pname = rdU32(); glTexParameteri(target, pname, rdI32()); break; }
+		case CAP_TEX_IMAGE_2D: {
+			GLenum target = rdU32();
+			GLint level = rdI32(), internalformat = rdI32();
+			GLsizei width = rdU32(), height = rdU32();
+			GLint border = rdI32();
+			GLenum format = rdU32(), type = rdU32();
+			glTexImage2D(target, level, internalformat, width, height, border, format, type, rdBytes());
+			break;
+		}
+		case CAP_TEX_SUB_IMAGE_2D: {
+			GLenum target = rdU32();
+			GLint level = rdI32(), xoffset = rdI32(), yoffset = rdI32();
+			GLsizei width = rdU32(), height = rdU32();
+			GLenum format = rdU32(), type = rdU32();
+			glTexSubImage2D(target, level, xoffset, yoffset, width, height, format, type, rdBytes());
+			break;
+		}
+		case CAP_GEN_FRAMEBUFFERS: genNames(framebuffers, glGenFramebuffers, glDeleteFramebuffers); break;
+		case CAP_BIND_FRAMEBUFFER: { GLenum target = rdU32(); glBindFramebuffer(target, mapName(framebuffers, rdU32())); break; }
+		case CAP_FRAMEBUFFER_TEXTURE_2D: {
+			GLenum target = rdU32(), attachment = rdU32(), textarget = rdU32();
+			GLuint texture = mapName(textures, rdU32());
+			glFramebufferTexture2D(target, attachment, textarget, texture, rdI32());
+			break;
+		}
+		case CAP_GEN_RENDERBUFFERS: genNames(renderbuffers, glGenRenderbuffers, glDeleteRenderbuffers); break;
+		case CAP_BIND_RENDERBUFFER: { GLenum target = rdU32(); glBindRenderbuffer(target, mapName(renderbuffers, rdU32())); break; }
+		case CAP_RENDERBUFFER_STORAGE: { GLenum target = rdU32(), internalformat = rdU32(); GLsizei w = rdU32(), h = rdU32(); glRenderbufferStorage(target, internalformat, w, h); break; }
+		case CAP_FRAMEBUFFER_RENDERBUFFER: {
+			GLenum target = rdU32(), attachment = rdU32(), rbtarget = rdU32();
+			glFramebufferRenderbuffer(target, attachment, rbtarget, mapName(renderbuffers, rdU32()));
+			break;
+		}
+		case CAP_BLIT_FRAMEBUFFER: {
+			GLint c[8];
+			for (int i=0; i < 8; i++)
+				c[i] = rdI32();
+			GLbitfield mask = rdU32();
+			glBlitFramebuffer(c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7], mask, rdU32());
+			break;
+		}
+
+		case CAP_TRANSFORM_FEEDBACK_VARYINGS: {
+			GLuint program = mapName(programs, rdU32());
+			GLsizei count = rdU32();
+			vector<string> names(count);
+			vector<const GLchar*> varyings(count);
+			for (int i=0; i < count; i++) {
+				unsigned int size;
+				const char *name = (const char*)rdBytes(&size);
+				names[i] = string(name, size);
+				varyings[i] = names[i].c_str();
+			}
+			glTransformFeedbackVaryings(program, count, count ? &varyings[0] : NULL, rdU32());
+			break;
+		}
+		case CAP_BIND_BUFFER_BASE: { GLenum target = rdU32(); GLuint index = rdU32(); glBindBufferBase(target, index, mapName(buffers, rdU32())); break; }
+		case CAP_BEGIN_TRANSFORM_FEEDBACK: glBeginTransformFeedback(rdU32()); break;
+		case CAP_END_TRANSFORM_FEEDBACK: glEndTransformFeedback(); break;
+		case CAP_GEN_TRANSFORM_FEEDBACKS: genNames(feedbacks, glGenTransformFeedbacks, glDeleteTransformFeedbacks); break;
+		case CAP_BIND_TRANSFORM_FEEDBACK: { GLenum target = rdU32(); glBindTransformFeedback(target, mapName(feedbacks, rdU32())); break; }
+		case CAP_DRAW_TRANSFORM_FEEDBACK: { GLenum mode = rdU32(); glDrawTransformFeedback(mode, mapName(feedbacks, rdU32())); break; }
+
+		default:
+			fprintf(stderr, "Error: unknown opcode %d at offset %lu\n", op, (unsigned long)pos-1);
+			exit(EXIT_FAILURE);
+	}
+	return op;
+}
+
+static void error_callback(int error, const char* description)
+{
+	fprintf(stderr, "Error: %s\n", description);
+}
+
+int main (int argc, char** argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s capture.bin [--loops N] [--no-swap]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	int loops = 10, do_swap = 1;
+	for (int i=2; i < argc; i++) {
+		if (!strcmp(argv[i], "--loops") && i+1 < argc)
+			loops = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--no-swap"))
+			do_swap = 0;
+	}
+
+	ifstream file(argv[1], ios::in | ios::binary);
+	stream.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+	if (stream.size() < 20 || memcmp(&stream[0], CAP_MAGIC, 8)) {
+		fprintf(stderr, "Error: %s is not a capture\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	pos = 8;
+	if (rdU32() != CAP_VERSION) {
+		fprintf(stderr, "Error: unsupported capture version\n");
+		return EXIT_FAILURE;
+	}
+	int width = rdU32(), height = rdU32();
+	// The stream may be cut short if the game exited mid-capture
+	stream.push_back(CAP_END);
+
+	glfwSetErrorCallback(error_callback);
+	if (!glfwInit())
+		return EXIT_FAILURE;
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	GLFWwindow* window = glfwCreateWindow(width, height, "replay", NULL, NULL);
+	if (!window) {
+		glfwTerminate();
+		return EXIT_FAILURE;
+	}
+	glfwMakeContextCurrent(window);
+	gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
+	glfwSwapInterval(0);
+
+	// Setup runs once
+	while (stream[pos] != CAP_FRAME && stream[pos] != CAP_END)
+		execute();
+	size_t frames_start = pos;
+	in_frames = 1;
+	glFinish();
+
+	long frames = 0;
+	double start = glfwGetTime();
+	for (int loop=0; loop < loops && !glfwWindowShouldClose(window); loop++) {
+		pos = frames_start;
+		int op;
+		while ((op = execute()) != CAP_END) {
+			if (op == CAP_FRAME && pos > frames_start + 1) {
+				frames++;
+				if (do_swap)
+					glfwSwapBuffers(window);
+			}
+		}
+		frames++;
+		if (do_swap)
+			glfwSwapBuffers(window);
+		releaseFrameNames();
+		glfwPollEvents();
+	}
+	glFinish();
+	double elapsed = glfwGetTime() - start;
+
+	if (frames > 0)
+		printf("%ld frames in %.3f s, %.3f ms/frame, %.1f fps\n", frames, elapsed, 1000*elapsed/frames, frames/elapsed);
+	glfwTerminate();
+	return EXIT_SUCCESS;
+}